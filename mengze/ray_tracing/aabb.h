@@ -40,17 +40,27 @@ class Aabb
 		return x_;
 	}
 
+	glm::vec3 min() const
+	{
+		return {x_.min(), y_.min(), z_.min()};
+	}
+
+	glm::vec3 max() const
+	{
+		return {x_.max(), y_.max(), z_.max()};
+	}
+
 	bool hit(const Ray &r, Interval ray_t) const
 	{
 		for (int i = 0; i < 3; i++)
 		{
-			auto inv_d  = 1.0f / r.direction()[i];
+			auto inv_d  = r.inv_direction()[i];
 			auto origin = r.origin()[i];
 
 			auto t0 = (axis(i).min() - origin) * inv_d;
 			auto t1 = (axis(i).max() - origin) * inv_d;
 
-			if (inv_d < 0.0f)
+			if (r.sign(i))
 			{
 				std::swap(t0, t1);
 			}
@@ -0,0 +1,174 @@
+#include "ray_tracing/adaptive_sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <limits>
+
+#include "ray_tracing/material.h"
+
+namespace mengze::rt
+{
+void AdaptiveSampling::resize(uint32_t width, uint32_t height)
+{
+	width_   = width;
+	height_  = height;
+	tiles_x_ = (width + RAY_PACKET_TILE - 1) / RAY_PACKET_TILE;
+	tiles_y_ = (height + RAY_PACKET_TILE - 1) / RAY_PACKET_TILE;
+	reset();
+}
+
+void AdaptiveSampling::reset()
+{
+	pixels_.assign(static_cast<size_t>(width_) * height_, {});
+	tile_errors_.assign(static_cast<size_t>(tiles_x_) * tiles_y_, std::numeric_limits<float>::infinity());
+	tile_active_.assign(tile_errors_.size(), 1);
+
+	active_tiles_.resize(tile_errors_.size());
+	for (uint32_t i = 0; i < active_tiles_.size(); ++i)
+	{
+		active_tiles_[i] = i;
+	}
+	active_pixel_count_ = pixels_.size();
+}
+
+void AdaptiveSampling::add_sample(uint32_t x, uint32_t y, const glm::vec3 &color)
+{
+	float luminance = rgb_to_luminance(color);
+	auto &pixel     = pixels_[static_cast<size_t>(y) * width_ + x];
+	pixel.luminance_sum += luminance;
+	pixel.luminance_squared_sum += luminance * luminance;
+	++pixel.sample_count;
+}
+
+uint32_t AdaptiveSampling::sample_count(uint32_t x, uint32_t y) const
+{
+	return pixels_[static_cast<size_t>(y) * width_ + x].sample_count;
+}
+
+float AdaptiveSampling::pixel_error(const PixelStatistics &statistics) const
+{
+	if (statistics.sample_count < 2)
+	{
+		return std::numeric_limits<float>::infinity();
+	}
+
+	auto  n        = static_cast<float>(statistics.sample_count);
+	float mean     = statistics.luminance_sum / n;
+	float variance = std::max((statistics.luminance_squared_sum - statistics.luminance_sum * mean) / (n - 1.0f), 0.0f);
+	return std::sqrt(variance / n) / std::max(mean, MIN_LUMINANCE);
+}
+
+void AdaptiveSampling::update_tiles(const AdaptiveSamplingOptions &options, bool retire)
+{
+	std::for_each(std::execution::par, active_tiles_.begin(), active_tiles_.end(), [this, &options, retire](uint32_t tile) {
+		uint32_t x0 = tile % tiles_x_ * RAY_PACKET_TILE;
+		uint32_t y0 = tile / tiles_x_ * RAY_PACKET_TILE;
+		uint32_t x1 = std::min(x0 + RAY_PACKET_TILE, width_);
+		uint32_t y1 = std::min(y0 + RAY_PACKET_TILE, height_);
+
+		float    squared_error = 0.0f;
+		uint32_t min_samples   = std::numeric_limits<uint32_t>::max();
+		for (uint32_t y = y0; y < y1; ++y)
+		{
+			for (uint32_t x = x0; x < x1; ++x)
+			{
+				const auto &pixel = pixels_[static_cast<size_t>(y) * width_ + x];
+				float       error = pixel_error(pixel);
+				squared_error += error * error;
+				min_samples = std::min(min_samples, pixel.sample_count);
+			}
+		}
+		float error        = std::sqrt(squared_error / static_cast<float>((x1 - x0) * (y1 - y0)));
+		tile_errors_[tile] = error;
+
+		bool converged = min_samples >= options.min_samples && error < options.error_threshold;
+		bool exhausted = options.max_samples > 0 && min_samples >= options.max_samples;
+		if (retire && (converged || exhausted))
+		{
+			tile_active_[tile] = 0;
+		}
+	});
+
+	active_tiles_.erase(std::remove_if(active_tiles_.begin(), active_tiles_.end(), [this](uint32_t tile) { return !tile_active_[tile]; }),
+	                    active_tiles_.end());
+
+	active_pixel_count_ = 0;
+	for (auto tile : active_tiles_)
+	{
+		active_pixel_count_ += tile_pixel_count(tile);
+	}
+}
+
+bool AdaptiveSampling::is_active(uint32_t x, uint32_t y) const
+{
+	return tile_active_[tile_index(x, y)];
+}
+
+const std::vector<uint32_t> &AdaptiveSampling::active_tiles() const
+{
+	return active_tiles_;
+}
+
+size_t AdaptiveSampling::active_pixel_count() const
+{
+	return active_pixel_count_;
+}
+
+float AdaptiveSampling::tile_error(uint32_t x, uint32_t y) const
+{
+	return tile_errors_[tile_index(x, y)];
+}
+
+uint32_t AdaptiveSampling::tile_count_x() const
+{
+	return tiles_x_;
+}
+
+uint64_t AdaptiveSampling::total_samples() const
+{
+	uint64_t total = 0;
+	for (const auto &pixel : pixels_)
+	{
+		total += pixel.sample_count;
+	}
+	return total;
+}
+
+float AdaptiveSampling::mean_luminance(uint32_t x, uint32_t y) const
+{
+	const auto &pixel = pixels_[static_cast<size_t>(y) * width_ + x];
+	return pixel.sample_count > 0 ? std::max(pixel.luminance_sum / static_cast<float>(pixel.sample_count), MIN_LUMINANCE) : MIN_LUMINANCE;
+}
+
+float AdaptiveSampling::relative_variance() const
+{
+	double sum    = 0.0;
+	size_t pixels = 0;
+	for (const auto &pixel : pixels_)
+	{
+		if (pixel.sample_count < 2)
+		{
+			continue;
+		}
+		auto  n        = static_cast<float>(pixel.sample_count);
+		float mean     = pixel.luminance_sum / n;
+		float variance = std::max((pixel.luminance_squared_sum - pixel.luminance_sum * mean) / (n - 1.0f), 0.0f);
+		sum += std::min(variance / std::max(mean * mean, MIN_LUMINANCE * MIN_LUMINANCE), MAX_RELATIVE_VARIANCE);
+		++pixels;
+	}
+	return pixels > 0 ? static_cast<float>(sum / static_cast<double>(pixels)) : 0.0f;
+}
+
+uint32_t AdaptiveSampling::tile_index(uint32_t x, uint32_t y) const
+{
+	return y / RAY_PACKET_TILE * tiles_x_ + x / RAY_PACKET_TILE;
+}
+
+size_t AdaptiveSampling::tile_pixel_count(uint32_t tile) const
+{
+	uint32_t x0 = tile % tiles_x_ * RAY_PACKET_TILE;
+	uint32_t y0 = tile / tiles_x_ * RAY_PACKET_TILE;
+	return static_cast<size_t>(std::min(RAY_PACKET_TILE, width_ - x0)) * std::min(RAY_PACKET_TILE, height_ - y0);
+}
+}        // namespace mengze::rt
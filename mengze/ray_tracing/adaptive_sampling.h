@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/ray_packet.h"
+
+namespace mengze::rt
+{
+struct AdaptiveSamplingOptions
+{
+	float    error_threshold{0.05f};        // relative standard error of a pixel's mean luminance
+	uint32_t min_samples{16};               // no tile is retired before every pixel has this many samples
+	uint32_t max_samples{0};                // tiles are retired once their pixels have this many, 0 for no cap
+};
+
+/**
+ * @brief Running luminance variance of every pixel and the convergence of RAY_PACKET_TILE sized tiles.
+ *
+ * The error of a pixel is the standard error of its mean luminance relative to the mean, with a floor on
+ * the mean so that black pixels do not need an unbounded number of samples. The error of a tile is the
+ * RMS of its pixels' errors, a maximum over 64 noisy estimates would hardly ever drop below the
+ * threshold. Once it does the tile is retired and gets no more samples.
+ */
+class AdaptiveSampling
+{
+  public:
+	void resize(uint32_t width, uint32_t height);
+
+	// Forgets all samples and reactivates every tile
+	void reset();
+
+	// Adds one sample of the pixel, pixels can be added concurrently as long as each is added by one thread
+	void add_sample(uint32_t x, uint32_t y, const glm::vec3 &color);
+
+	uint32_t sample_count(uint32_t x, uint32_t y) const;
+
+	// Recomputes the error of the active tiles and, if retire is set, retires the converged ones
+	void update_tiles(const AdaptiveSamplingOptions &options, bool retire);
+
+	bool is_active(uint32_t x, uint32_t y) const;
+
+	// Indices of the tiles that still take samples, a tile's index is tile_y * tile_count_x() + tile_x
+	const std::vector<uint32_t> &active_tiles() const;
+
+	// Number of pixels in the active tiles
+	size_t active_pixel_count() const;
+
+	float tile_error(uint32_t x, uint32_t y) const;
+
+	uint32_t tile_count_x() const;
+
+	uint64_t total_samples() const;
+
+	// Mean luminance of the pixel's samples, at least MIN_LUMINANCE like the relative errors
+	float mean_luminance(uint32_t x, uint32_t y) const;
+
+	// Variance of one sample's luminance over the squared mean, clamped and averaged over the pixels with two samples
+	float relative_variance() const;
+
+  private:
+	struct PixelStatistics
+	{
+		float    luminance_sum{0.0f};
+		float    luminance_squared_sum{0.0f};
+		uint32_t sample_count{0};
+	};
+
+	float pixel_error(const PixelStatistics &statistics) const;
+
+	uint32_t tile_index(uint32_t x, uint32_t y) const;
+
+	size_t tile_pixel_count(uint32_t tile) const;
+
+	static constexpr float MIN_LUMINANCE         = 0.01f;
+	static constexpr float MAX_RELATIVE_VARIANCE = 1.0f;        // per pixel, larger ones come from a few outliers
+
+	uint32_t width_{0};
+	uint32_t height_{0};
+	uint32_t tiles_x_{0};
+	uint32_t tiles_y_{0};
+
+	std::vector<PixelStatistics> pixels_;
+	std::vector<float>           tile_errors_;
+	std::vector<uint8_t>         tile_active_;
+	std::vector<uint32_t>        active_tiles_;
+	size_t                       active_pixel_count_{0};
+};
+}        // namespace mengze::rt
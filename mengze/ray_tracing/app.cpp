@@ -41,11 +41,13 @@ void ray_tracing_app_setup(mengze::Application &app)
 	scene->add(std::make_shared<Triangle>(glm::vec3(0, 555, 0), glm::vec3(555, 555, 0), glm::vec3(0, 555, 555), white));
 	scene->add(std::make_shared<Triangle>(glm::vec3(555, 555, 0), glm::vec3(555, 555, 555), glm::vec3(0, 555, 555), white));
 
-	scene->add(std::make_shared<Triangle>(glm::vec3(213, 554, 227), glm::vec3(343, 554, 227), glm::vec3(343, 554, 332), light));
-	scene->add(std::make_shared<Triangle>(glm::vec3(213, 554, 227), glm::vec3(343, 554, 332), glm::vec3(213, 554, 332), light));
-
-	scene->add_light(std::make_shared<Triangle>(glm::vec3(213, 554, 227), glm::vec3(343, 554, 227), glm::vec3(343, 554, 332), light));
-	scene->add_light(std::make_shared<Triangle>(glm::vec3(213, 554, 227), glm::vec3(343, 554, 332), glm::vec3(213, 554, 332), light));
+	// The same objects go into the world and the lights, so hits on them report their light_id
+	auto light0 = std::make_shared<Triangle>(glm::vec3(213, 554, 227), glm::vec3(343, 554, 227), glm::vec3(343, 554, 332), light, std::nullopt);
+	auto light1 = std::make_shared<Triangle>(glm::vec3(213, 554, 227), glm::vec3(343, 554, 332), glm::vec3(213, 554, 332), light, std::nullopt);
+	scene->add(light0);
+	scene->add(light1);
+	scene->add_light(light0);
+	scene->add_light(light1);
 
 	/*scene->add(std::make_shared<Quad>(glm::vec3(343, 554, 332), glm::vec3(-130, 0, 0), glm::vec3(0, 0, -105), light));*/
 
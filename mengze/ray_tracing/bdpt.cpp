@@ -0,0 +1,461 @@
+#include "ray_tracing/bdpt.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mengze::rt
+{
+namespace
+{
+// Delta vertices have density 0, the ratios of the weights treat it as 1 and skip their techniques instead
+float remap0(float pdf)
+{
+	return pdf != 0.0f ? pdf : 1.0f;
+}
+
+bool is_black(const glm::vec3 &c)
+{
+	return c.x == 0.0f && c.y == 0.0f && c.z == 0.0f;
+}
+}        // namespace
+
+BidirectionalPathTracer::BidirectionalPathTracer(const Hittable &scene, const Camera &camera, const LightSampler &lights, int max_depth) :
+    scene_(scene), camera_(camera), lights_(lights), max_depth_(std::clamp(max_depth, 0, MAX_VERTICES - 2))
+{
+}
+
+glm::vec3 BidirectionalPathTracer::sample(uint32_t x, uint32_t y, Sampler &sampler, SplatFilm &film) const
+{
+	Vertex camera_path[MAX_VERTICES];
+	Vertex light_path[MAX_VERTICES];
+	int    camera_count = camera_subpath(x, y, sampler, camera_path);
+	int    light_count  = light_subpath(sampler, light_path);
+
+	// Light samples (s == 1, t > 1) do not use the light subpath, they are taken also when there is none, as with
+	// only an environment
+	glm::vec3 radiance{0.0f};
+	for (int t = 1; t <= camera_count; ++t)
+	{
+		for (int s = 0; s <= std::max(light_count, 1); ++s)
+		{
+			int depth = s + t - 2;
+			if (depth < 0 || depth > max_depth_ || (s > light_count && t == 1))
+			{
+				continue;
+			}
+			radiance += connect(light_path, s, camera_path, t, sampler, film);
+		}
+	}
+	return radiance;
+}
+
+int BidirectionalPathTracer::camera_subpath(uint32_t x, uint32_t y, Sampler &sampler, Vertex *path) const
+{
+	path[0]              = Vertex{};
+	path[0].type         = VertexType::kCamera;
+	path[0].rec.position = camera_.position();
+	path[0].beta         = glm::vec3{1.0f};
+	path[0].connectible  = true;
+
+	// The importance of a pinhole camera over its density is 1
+	Ray ray = camera_.get_ray(static_cast<float>(x), static_cast<float>(y), sampler);
+	return random_walk(ray, glm::vec3{1.0f}, camera_pdf(ray.origin() + ray.direction()), sampler, path, max_depth_ + 2);
+}
+
+int BidirectionalPathTracer::light_subpath(Sampler &sampler, Vertex *path) const
+{
+	EmissionSample emission;
+	if (!lights_.sample_emission(sampler, emission))
+	{
+		return 0;
+	}
+
+	path[0]              = Vertex{};
+	path[0].type         = VertexType::kLight;
+	path[0].rec.position = emission.ray.origin();
+	path[0].rec.normal   = emission.normal;
+	path[0].rec.light_id = emission.light_id;
+	path[0].beta         = emission.radiance / emission.pdf_position;
+	path[0].connectible  = true;
+	path[0].pdf_fwd      = emission.pdf_position;
+
+	glm::vec3 beta = path[0].beta * std::fabs(glm::dot(emission.normal, emission.ray.direction())) / emission.pdf_direction;
+	return random_walk(emission.ray, beta, emission.pdf_direction, sampler, path, max_depth_ + 1);
+}
+
+int BidirectionalPathTracer::random_walk(Ray ray, glm::vec3 beta, float pdf, Sampler &sampler, Vertex *path, int max_vertices) const
+{
+	int count = 1;
+	while (count < max_vertices)
+	{
+		HitRecord rec;
+		if (!scene_.hit(ray, Interval(0.001f), rec))
+		{
+			// Camera rays that escape end on the environment, pdf_fwd stays a solid angle density there
+			if (path[0].type == VertexType::kCamera && lights_.environment())
+			{
+				Vertex &v      = path[count++];
+				v              = Vertex{};
+				v.type         = VertexType::kLight;
+				v.incoming     = glm::normalize(ray.direction());
+				v.rec.position = ray.origin() + v.incoming;
+				v.rec.light_id = ENVIRONMENT_LIGHT_ID;
+				v.beta         = beta;
+				v.pdf_fwd      = pdf;
+			}
+			break;
+		}
+
+		Vertex &prev = path[count - 1];
+		Vertex &v    = path[count++];
+		v            = Vertex{};
+		v.rec        = rec;
+		v.incoming   = ray.direction();
+		v.beta       = beta;
+		v.pdf_fwd    = to_area(pdf, prev, v);
+		if (count == max_vertices || !rec.material->scatter(ray, rec, v.scatter, sampler))
+		{
+			break;
+		}
+
+		// Specular vertices cannot be connected to, and their densities stay 0 in both directions
+		if (v.scatter.skip_pdf)
+		{
+			v.delta      = true;
+			beta        *= v.scatter.attenuation;
+			pdf          = 0.0f;
+			prev.pdf_rev = 0.0f;
+			ray          = v.scatter.skip_pdf_ray;
+			continue;
+		}
+		v.connectible = true;
+
+		Ray scattered(rec.position, v.scatter.pdf.generate(sampler));
+		pdf = v.scatter.pdf.value(scattered.direction());
+		if (pdf <= 0.0f)
+		{
+			break;
+		}
+		beta         *= v.scatter.attenuation * rec.material->scattering_pdf(ray, rec, scattered) / pdf;
+		prev.pdf_rev  = to_area(bsdf_pdf(v, rec.position + scattered.direction(), prev.rec.position), v, prev);
+		ray           = scattered;
+		if (is_black(beta))
+		{
+			break;
+		}
+	}
+	return count;
+}
+
+glm::vec3 BidirectionalPathTracer::connect(Vertex *light_path, int s, Vertex *camera_path, int t, Sampler &sampler, SplatFilm &film) const
+{
+	Vertex    sampled;
+	glm::vec3 radiance{0.0f};
+	uint32_t  x = 0;
+	uint32_t  y = 0;
+	if (s == 0)
+	{
+		// The camera subpath hit an emitter or escaped to the environment by itself
+		const Vertex &pt = camera_path[t - 1];
+		if (pt.type == VertexType::kSurface && pt.rec.light_id != INVALID_LIGHT_ID)
+		{
+			radiance = pt.beta * pt.rec.material->emitted(pt.rec.u, pt.rec.v, pt.rec.position);
+		}
+		else if (pt.rec.light_id == ENVIRONMENT_LIGHT_ID)
+		{
+			radiance = pt.beta * lights_.environment()->radiance(pt.incoming);
+		}
+	}
+	else if (t == 1)
+	{
+		// Light tracing, the vertex is seen by whichever pixel it projects to
+		const Vertex &qs = light_path[s - 1];
+		if (qs.connectible && camera_.raster_position(qs.rec.position, x, y))
+		{
+			sampled              = camera_path[0];
+			glm::vec3 to_camera  = camera_.position() - qs.rec.position;
+			float     distance2  = glm::dot(to_camera, to_camera);
+			float     cosine     = camera_.view_cosine(qs.rec.position);
+			float     importance = 1.0f / (camera_.image_area() * cosine * cosine * cosine);
+			radiance = qs.beta * f(qs, sampled) * std::fabs(glm::dot(qs.rec.normal, to_camera)) * importance / (distance2 * std::sqrt(distance2));
+		}
+	}
+	else if (s == 1)
+	{
+		// Next event estimation, a light endpoint is sampled for the camera vertex instead of taking the subpath's.
+		// Environment samples keep the solid angle density they were drawn with
+		const Vertex &pt = camera_path[t - 1];
+		LightSample   light_sample;
+		if (pt.connectible && lights_.sample(pt.rec.position, sampler, light_sample))
+		{
+			sampled.type         = VertexType::kLight;
+			sampled.rec.position = light_sample.position;
+			sampled.rec.normal   = light_sample.normal;
+			sampled.rec.light_id = light_sample.light_id;
+			sampled.beta         = light_sample.radiance / light_sample.pdf;
+			sampled.connectible  = true;
+			sampled.pdf_fwd      = light_sample.light_id == ENVIRONMENT_LIGHT_ID ? light_sample.pdf : pdf_light_origin(sampled);
+
+			glm::vec3 direction = glm::normalize(light_sample.position - pt.rec.position);
+			radiance            = pt.beta * f(pt, sampled) * sampled.beta * std::fabs(glm::dot(pt.rec.normal, direction));
+		}
+	}
+	else
+	{
+		const Vertex &qs = light_path[s - 1];
+		const Vertex &pt = camera_path[t - 1];
+		if (qs.connectible && pt.connectible)
+		{
+			glm::vec3 offset    = pt.rec.position - qs.rec.position;
+			float     distance2 = glm::dot(offset, offset);
+			float     geometry  = std::fabs(glm::dot(qs.rec.normal, offset) * glm::dot(pt.rec.normal, offset)) / (distance2 * distance2);
+			radiance            = qs.beta * f(qs, pt) * f(pt, qs) * pt.beta * geometry;
+		}
+	}
+
+	if (is_black(radiance) || !std::isfinite(radiance.x + radiance.y + radiance.z))
+	{
+		return glm::vec3{0.0f};
+	}
+
+	// The emitter of s == 0 needs no shadow ray, every other technique connects two vertices
+	if (s > 0)
+	{
+		const Vertex &qs = s == 1 ? (t == 1 ? light_path[0] : sampled) : light_path[s - 1];
+		const Vertex &pt = t == 1 ? sampled : camera_path[t - 1];
+		if (!visible(qs, pt))
+		{
+			return glm::vec3{0.0f};
+		}
+	}
+
+	radiance *= mis_weight(light_path, s, camera_path, t, sampled);
+	if (t == 1)
+	{
+		film.add(x, y, radiance);
+		return glm::vec3{0.0f};
+	}
+	return radiance;
+}
+
+float BidirectionalPathTracer::mis_weight(const Vertex *light_path, int s, const Vertex *camera_path, int t, const Vertex &sampled) const
+{
+	if (s == 0 && camera_path[t - 1].rec.light_id == ENVIRONMENT_LIGHT_ID)
+	{
+		return environment_mis_weight(camera_path, t - 2, camera_path[t - 1].pdf_fwd, camera_path[t - 1].incoming, true);
+	}
+	if (s == 1 && t > 1 && sampled.rec.light_id == ENVIRONMENT_LIGHT_ID)
+	{
+		return environment_mis_weight(camera_path, t - 1, 0.0f, sampled.rec.position - camera_path[t - 1].rec.position, false);
+	}
+
+	// Densities of the path as this technique sees it, the connection changes them around its two vertices
+	struct Densities
+	{
+		float fwd;
+		float rev;
+		bool  delta;
+	};
+	Densities light[MAX_VERTICES];
+	Densities camera[MAX_VERTICES];
+	for (int i = 0; i < s; ++i)
+	{
+		light[i] = {light_path[i].pdf_fwd, light_path[i].pdf_rev, light_path[i].delta};
+	}
+	for (int i = 0; i < t; ++i)
+	{
+		camera[i] = {camera_path[i].pdf_fwd, camera_path[i].pdf_rev, camera_path[i].delta};
+	}
+
+	const Vertex &pt       = t == 1 ? sampled : camera_path[t - 1];
+	const Vertex *pt_minus = t > 1 ? &camera_path[t - 2] : nullptr;
+	if (s == 0)
+	{
+		camera[t - 1].rev = pdf_light_origin(pt);
+		if (pt_minus)
+		{
+			camera[t - 2].rev = pdf_light(pt, *pt_minus);
+		}
+	}
+	else
+	{
+		const Vertex &qs       = s == 1 && t > 1 ? sampled : light_path[s - 1];
+		const Vertex *qs_minus = s > 1 ? &light_path[s - 2] : nullptr;
+		if (s == 1)
+		{
+			light[0].fwd = qs.pdf_fwd;
+		}
+		light[s - 1].delta = false;
+		light[s - 1].rev   = pdf(pt, pt_minus, qs);
+		if (qs_minus)
+		{
+			light[s - 2].rev = pdf(qs, &pt, *qs_minus);
+		}
+		camera[t - 1].rev = pdf(qs, qs_minus, pt);
+		if (pt_minus)
+		{
+			camera[t - 2].rev = pdf(pt, &qs, *pt_minus);
+		}
+	}
+	camera[t - 1].delta = false;
+
+	// Ratios of the squared densities of the other techniques to this one's, walking away from the connection
+	float sum   = 0.0f;
+	float ratio = 1.0f;
+	for (int i = t - 1; i > 0; --i)
+	{
+		ratio *= remap0(camera[i].rev) / remap0(camera[i].fwd);
+		if (!camera[i].delta && !camera[i - 1].delta)
+		{
+			sum += ratio * ratio;
+		}
+	}
+	ratio = 1.0f;
+	for (int i = s - 1; i >= 0; --i)
+	{
+		ratio *= remap0(light[i].rev) / remap0(light[i].fwd);
+		if (!light[i].delta && (i == 0 || !light[i - 1].delta))
+		{
+			sum += ratio * ratio;
+		}
+	}
+	return 1.0f / (1.0f + sum);
+}
+
+float BidirectionalPathTracer::environment_mis_weight(const Vertex *camera_path, int last, float bsdf_density, const glm::vec3 &direction,
+                                                      bool escaped) const
+{
+	// Only the camera subpath escaping from its last vertex and a light sample there produce the path. Both
+	// share every vertex up to it, so the weight only compares the two solid angle densities of the final direction
+	const Vertex &v = camera_path[last];
+	if (v.type != VertexType::kSurface || !v.connectible)
+	{
+		return escaped ? 1.0f : 0.0f;
+	}
+
+	if (!escaped)
+	{
+		bsdf_density = bsdf_pdf(v, camera_path[last - 1].rec.position, v.rec.position + direction);
+	}
+	float light_density = lights_.environment_pdf(glm::normalize(direction));
+	return escaped ? power_heuristic(bsdf_density, light_density) : power_heuristic(light_density, bsdf_density);
+}
+
+glm::vec3 BidirectionalPathTracer::f(const Vertex &v, const Vertex &next) const
+{
+	// Emitters radiate the same in every direction, their radiance is already in the vertex's beta
+	if (v.type == VertexType::kLight)
+	{
+		return glm::vec3{1.0f};
+	}
+	if (v.type != VertexType::kSurface || !v.connectible)
+	{
+		return glm::vec3{0.0f};
+	}
+
+	glm::vec3 direction = glm::normalize(next.rec.position - v.rec.position);
+	float     cosine    = std::fabs(glm::dot(v.rec.normal, direction));
+	if (cosine < 1e-6f)
+	{
+		return glm::vec3{0.0f};
+	}
+	Ray ray_in(v.rec.position - v.incoming, v.incoming);
+	return v.scatter.attenuation * v.rec.material->scattering_pdf(ray_in, v.rec, Ray(v.rec.position, direction)) / cosine;
+}
+
+float BidirectionalPathTracer::pdf(const Vertex &v, const Vertex *prev, const Vertex &next) const
+{
+	switch (v.type)
+	{
+		case VertexType::kLight:
+			return pdf_light(v, next);
+		case VertexType::kCamera:
+			return to_area(camera_pdf(next.rec.position), v, next);
+		case VertexType::kSurface:
+			return prev ? to_area(bsdf_pdf(v, prev->rec.position, next.rec.position), v, next) : 0.0f;
+	}
+	return 0.0f;
+}
+
+float BidirectionalPathTracer::bsdf_pdf(const Vertex &v, const glm::vec3 &from, const glm::vec3 &to) const
+{
+	if (!v.connectible)
+	{
+		return 0.0f;
+	}
+
+	// The materials only reflect, so both directions have to be on the side facing from
+	HitRecord rec      = v.rec;
+	glm::vec3 incoming = v.rec.position - from;
+	if (glm::dot(rec.normal, incoming) > 0.0f)
+	{
+		rec.normal = -rec.normal;
+	}
+	glm::vec3 outgoing = to - v.rec.position;
+	if (glm::dot(rec.normal, outgoing) <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// Diffuse and glossy materials build their pdf without drawing samples
+	ScatterRecord scatter_record;
+	Sampler       unused;
+	if (!rec.material->scatter(Ray(from, incoming), rec, scatter_record, unused) || scatter_record.skip_pdf)
+	{
+		return 0.0f;
+	}
+	return scatter_record.pdf.value(outgoing);
+}
+
+float BidirectionalPathTracer::pdf_light(const Vertex &v, const Vertex &next) const
+{
+	float pdf_position  = 0.0f;
+	float pdf_direction = 0.0f;
+	lights_.emission_pdf(v.rec.light_id, v.rec.normal, next.rec.position - v.rec.position, pdf_position, pdf_direction);
+	return to_area(pdf_direction, v, next);
+}
+
+float BidirectionalPathTracer::pdf_light_origin(const Vertex &v) const
+{
+	float pdf_position  = 0.0f;
+	float pdf_direction = 0.0f;
+	lights_.emission_pdf(v.rec.light_id, v.rec.normal, v.rec.normal, pdf_position, pdf_direction);
+	return pdf_position;
+}
+
+float BidirectionalPathTracer::camera_pdf(const glm::vec3 &p) const
+{
+	uint32_t x = 0;
+	uint32_t y = 0;
+	if (!camera_.raster_position(p, x, y))
+	{
+		return 0.0f;
+	}
+
+	// Uniform over the image at unit distance, whose area element is dA = dw / cos^3
+	float cosine = camera_.view_cosine(p);
+	return 1.0f / (camera_.image_area() * cosine * cosine * cosine);
+}
+
+bool BidirectionalPathTracer::visible(const Vertex &a, const Vertex &b) const
+{
+	return !scene_.occluded(Ray(a.rec.position, b.rec.position - a.rec.position), Interval(0.001f, 0.999f));
+}
+
+float BidirectionalPathTracer::to_area(float pdf, const Vertex &from, const Vertex &to)
+{
+	glm::vec3 offset    = to.rec.position - from.rec.position;
+	float     distance2 = glm::dot(offset, offset);
+	if (distance2 <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// The camera is a point, there is no surface to project on
+	if (to.type == VertexType::kCamera)
+	{
+		return pdf / distance2;
+	}
+	return pdf * std::fabs(glm::dot(to.rec.normal, offset)) / (distance2 * std::sqrt(distance2));
+}
+}        // namespace mengze::rt
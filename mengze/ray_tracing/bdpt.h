@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/camera.h"
+#include "ray_tracing/hittable.h"
+#include "ray_tracing/light_sampler.h"
+#include "ray_tracing/sampler.h"
+#include "ray_tracing/splat_film.h"
+
+namespace mengze::rt
+{
+/**
+ * @brief Bidirectional path tracer (Veach 1997): every sample traces a subpath from the camera and one
+ * from a light, and connects every prefix of one to every prefix of the other.
+ *
+ * Each connection is a technique for sampling paths of its length, and the techniques are weighted
+ * against each other with the power heuristic. The weights need the area density of every vertex as its
+ * own subpath generated it and as the opposite subpath would have, which the random walks store on the
+ * vertices, so a connection only evaluates the few densities it changes. Connections to the camera
+ * (light tracing) land on whichever pixel sees the vertex and are added to a SplatFilm. Camera subpaths
+ * that escape end on the environment, whose paths are weighted against its light samples only.
+ */
+class BidirectionalPathTracer
+{
+  public:
+	BidirectionalPathTracer(const Hittable &scene, const Camera &camera, const LightSampler &lights, int max_depth);
+
+	// Radiance the pixel gathers through its camera subpath, light tracing adds to other pixels of the film
+	glm::vec3 sample(uint32_t x, uint32_t y, Sampler &sampler, SplatFilm &film) const;
+
+	// Longest subpath, endpoints included, paths of more than MAX_VERTICES - 2 bounces are cut
+	static constexpr int MAX_VERTICES = 16;
+
+  private:
+	enum class VertexType
+	{
+		kCamera,
+		kLight,
+		kSurface,
+	};
+
+	struct Vertex
+	{
+		VertexType    type{VertexType::kSurface};
+		HitRecord     rec;                        // normal faces the side the vertex was reached from
+		glm::vec3     incoming{0.0f};             // direction of the ray that reached the vertex
+		ScatterRecord scatter{};
+		glm::vec3     beta{0.0f};                 // throughput of the subpath up to the vertex
+		bool          delta{false};
+		bool          connectible{false};
+		float         pdf_fwd{0.0f};              // area density of the vertex from its own subpath
+		float         pdf_rev{0.0f};              // area density of the vertex from the opposite subpath
+	};
+
+	// Extends a subpath whose endpoint is path[0], pdf is the solid angle density of the ray, returns the vertex count
+	int random_walk(Ray ray, glm::vec3 beta, float pdf, Sampler &sampler, Vertex *path, int max_vertices) const;
+
+	int camera_subpath(uint32_t x, uint32_t y, Sampler &sampler, Vertex *path) const;
+
+	int light_subpath(Sampler &sampler, Vertex *path) const;
+
+	// Contribution of the technique with s light and t camera vertices, already weighted
+	glm::vec3 connect(Vertex *light_path, int s, Vertex *camera_path, int t, Sampler &sampler, SplatFilm &film) const;
+
+	// Power heuristic weight of the technique, sampled is the endpoint connect() sampled for s == 1 or t == 1
+	float mis_weight(const Vertex *light_path, int s, const Vertex *camera_path, int t, const Vertex &sampled) const;
+
+	/**
+	 * @brief Weight of a path that ends on the environment, which light subpaths never start on.
+	 *
+	 * last indexes the final camera vertex before the environment. escaped tells the camera subpath's own
+	 * escape (s == 0, bsdf_density is the density it was sampled with) from a light sample there (s == 1).
+	 */
+	float environment_mis_weight(const Vertex *camera_path, int last, float bsdf_density, const glm::vec3 &direction, bool escaped) const;
+
+	// BSDF at v for light between the vertex it was reached from and next
+	glm::vec3 f(const Vertex &v, const Vertex &next) const;
+
+	// Area density of sampling next from v, which was reached from prev
+	float pdf(const Vertex &v, const Vertex *prev, const Vertex &next) const;
+
+	// Solid angle density of the BSDF at v sampling the direction towards to, for light arriving from from
+	float bsdf_pdf(const Vertex &v, const glm::vec3 &from, const glm::vec3 &to) const;
+
+	// Area density of an emitter vertex v emitting towards next
+	float pdf_light(const Vertex &v, const Vertex &next) const;
+
+	// Area density of a light subpath starting at the emitter vertex v
+	float pdf_light_origin(const Vertex &v) const;
+
+	// Solid angle density of get_ray() towards p, over the whole image
+	float camera_pdf(const glm::vec3 &p) const;
+
+	bool visible(const Vertex &a, const Vertex &b) const;
+
+	// Converts a solid angle density at from to an area density at to
+	static float to_area(float pdf, const Vertex &from, const Vertex &to);
+
+	const Hittable     &scene_;
+	const Camera       &camera_;
+	const LightSampler &lights_;
+	int                 max_depth_;
+};
+}        // namespace mengze::rt
@@ -1,139 +1,140 @@
 #include "ray_tracing/bvh.h"
 
-#include <execution>
-#include <future>
-
-#include "scene.h"
+#include "core/timer.h"
+#include "ray_tracing/bvh_traversal.h"
+#include "ray_tracing/scene.h"
 
 namespace mengze::rt
 {
-BvhNode::BvhNode(const HittableList &list) :
-    BvhNode(list.objects(), 0, list.objects().size())
+Bvh::Bvh(const HittableList &list, const BvhBuildOptions &options) :
+    Bvh(list.objects(), options)
 {}
 
-BvhNode::BvhNode(const std::vector<std::shared_ptr<Hittable>> &src_objects, size_t start, size_t end, bool is_root, int depth)
+Bvh::Bvh(const std::vector<std::shared_ptr<Hittable>> &objects, const BvhBuildOptions &options)
 {
-	auto objects = src_objects;
-	if (is_root)
+	if (objects.empty())
 	{
-		is_root_          = true;
-		root_all_objects_ = src_objects;
+		return;
 	}
 
-	auto axis       = static_cast<int>(3 * random_float());
-	auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare :
-	                                                              box_z_compare;
-
-	auto object_span = end - start;
+	Timer timer;
 
-	if (object_span == 1)
+	std::vector<Aabb> bounds;
+	bounds.reserve(objects.size());
+	for (const auto &object : objects)
 	{
-		left_ = right_ = objects[start];
+		bounds.push_back(object->bounding_box());
 	}
-	else if (object_span == 2)
+
+	BvhBuilder            builder(options);
+	std::vector<uint32_t> order;
+	builder.build(bounds, nodes_, order);
+
+	objects_.reserve(objects.size());
+	for (auto index : order)
 	{
-		if (comparator(objects[start], objects[start + 1]))
-		{
-			left_  = objects[start];
-			right_ = objects[start + 1];
-		}
-		else
-		{
-			left_  = objects[start + 1];
-			right_ = objects[start];
-		}
+		objects_.push_back(objects[index]);
 	}
-	else
-	{
-		// if (object_span > 10000)
-		//	std::sort(std::execution::par, objects.begin() + start, objects.begin() + end, comparator);
-		// else
-		std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
-		auto mid = start + object_span / 2;
+	box_        = Aabb(nodes_[0].min, nodes_[0].max);
+	sah_cost_   = builder.sah_cost(nodes_);
+	build_time_ = timer.elapsed();
+}
 
-		if (depth < 5)
-		{
-			auto future_left  = std::async(std::launch::async, [&]() {
-                return std::make_shared<BvhNode>(objects, start, mid, false, depth + 1);
-            });
-			auto future_right = std::async(std::launch::async, [&]() {
-				return std::make_shared<BvhNode>(objects, mid, end, false, depth + 1);
-			});
-			left_             = future_left.get();
-			right_            = future_right.get();
-		}
-		else
-		{
-			left_  = std::make_shared<BvhNode>(objects, start, mid, false, depth + 1);
-			right_ = std::make_shared<BvhNode>(objects, mid, end, false, depth + 1);	
-		}
-		
+bool Bvh::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
+{
+	auto intersect_leaf = [&](uint32_t first, uint32_t count, Interval &leaf_t) {
+		return intersect_objects(r, first, count, leaf_t, rec);
+	};
+
+	if (!wide_.empty())
+	{
+		return wide_.intersect(r, ray_t, intersect_leaf);
 	}
+	return bvh::intersect(nodes_, r, ray_t, intersect_leaf);
+}
 
-	auto box_left  = left_->bounding_box();
-	auto box_right = right_->bounding_box();
+bool Bvh::occluded(const Ray &r, Interval ray_t) const
+{
+	auto occluded_leaf = [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			if (objects_[i]->occluded(r, ray_t))
+			{
+				return true;
+			}
+		}
+		return false;
+	};
 
-	box_ = Aabb(box_left, box_right);
+	if (!wide_.empty())
+	{
+		return wide_.occluded(r, ray_t, occluded_leaf);
+	}
+	return bvh::occluded(nodes_, r, ray_t, occluded_leaf);
 }
 
-bool BvhNode::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
+bool Bvh::intersect_objects(const Ray &r, uint32_t first, uint32_t count, Interval &ray_t, HitRecord &rec) const
 {
-	if (!box_.hit(r, ray_t))
+	bool hit_anything = false;
+	for (uint32_t i = first; i < first + count; ++i)
 	{
-		return false;
+		if (objects_[i]->hit(r, ray_t, rec))
+		{
+			hit_anything = true;
+			ray_t.max()  = rec.t;
+		}
 	}
+	return hit_anything;
+}
 
-	auto hit_left  = left_->hit(r, ray_t, rec);
-	auto hit_right = right_->hit(r, Interval(ray_t.min(), hit_left ? rec.t : ray_t.max()), rec);
-
-	return hit_left || hit_right;
+LaneMask Bvh::hit_packet(RayPacket &packet, LaneMask active, HitRecord *records) const
+{
+	return bvh::intersect_packet(nodes_, packet, active, [&](uint32_t first, uint32_t count, LaneMask lanes) {
+		LaneMask hits = 0;
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			hits |= objects_[i]->hit_packet(packet, lanes, records);
+		}
+		return hits;
+	});
 }
 
-Aabb BvhNode::bounding_box() const
+Aabb Bvh::bounding_box() const
 {
 	return box_;
 }
 
-float BvhNode::pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const
+void Bvh::collect_emitters(std::vector<Emitter> &emitters)
 {
-	auto weight = 1.0f / root_all_objects_.size();
-	auto sum    = 0.0f;
-
-	for (const auto &object : root_all_objects_)
+	for (const auto &object : objects_)
 	{
-		sum += weight * object->pdf_value(origin, direction);
+		object->collect_emitters(emitters);
 	}
-	return sum;
 }
 
-glm::vec3 BvhNode::random(const glm::vec3 &origin) const
+void Bvh::collapse()
 {
-	auto index = static_cast<int>(random_float() * root_all_objects_.size());
-	index      = std::min(index, static_cast<int>(root_all_objects_.size()) - 1);
-	return root_all_objects_[index]->random(origin);
+	wide_ = WideBvh(nodes_);
 }
 
-bool BvhNode::box_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b, int axis)
+bool Bvh::is_collapsed() const
 {
-	auto box_a = a->bounding_box();
-	auto box_b = b->bounding_box();
-
-	return box_a.axis(axis).min() < box_b.axis(axis).min();
+	return !wide_.empty();
 }
 
-bool BvhNode::box_x_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b)
+size_t Bvh::node_count() const
 {
-	return box_compare(a, b, 0);
+	return nodes_.size();
 }
 
-bool BvhNode::box_y_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b)
+float Bvh::sah_cost() const
 {
-	return box_compare(a, b, 1);
+	return sah_cost_;
 }
 
-bool BvhNode::box_z_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b)
+float Bvh::build_time() const
 {
-	return box_compare(a, b, 2);
+	return build_time_;
 }
 }        // namespace mengze::rt
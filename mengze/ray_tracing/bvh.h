@@ -1,39 +1,59 @@
 #pragma once
 
+#include <vector>
+
 #include "ray_tracing/aabb.h"
+#include "ray_tracing/bvh_builder.h"
 #include "ray_tracing/hittable.h"
+#include "ray_tracing/wide_bvh.h"
 
 namespace mengze::rt
 {
 class HittableList;
-class BvhNode final : public Hittable
+
+class Bvh final : public Hittable
 {
   public:
-	BvhNode(const HittableList &list);
+	explicit Bvh(const HittableList &list, const BvhBuildOptions &options = {});
 
-	BvhNode(const std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end, bool is_root = true, int depth = 0);
+	explicit Bvh(const std::vector<std::shared_ptr<Hittable>> &objects, const BvhBuildOptions &options = {});
 
 	bool hit(const Ray &r, Interval ray_t, HitRecord &rec) const override;
 
+	bool occluded(const Ray &r, Interval ray_t) const override;
+
+	// Traverses the binary tree once for the whole packet, also when the tree is collapsed
+	LaneMask hit_packet(RayPacket &packet, LaneMask active, HitRecord *records) const override;
+
 	Aabb bounding_box() const override;
 
-	float pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const override;
+	void collect_emitters(std::vector<Emitter> &emitters) override;
+
+	// Collapses the binary tree into a BVH4/BVH8 that is used for single rays from then on
+	void collapse();
 
-	glm::vec3 random(const glm::vec3 &origin) const override;
+	bool is_collapsed() const;
 
-private:
-	static bool box_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b, int axis);
-	static bool box_x_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b);
-	static bool box_y_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b);
-	static bool box_z_compare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b);
+	size_t node_count() const;
+
+	float sah_cost() const;
+
+	// Build time in milliseconds
+	float build_time() const;
 
   private:
-	std::shared_ptr<Hittable> left_;
-	std::shared_ptr<Hittable> right_;
+	bool intersect_objects(const Ray &r, uint32_t first, uint32_t count, Interval &ray_t, HitRecord &rec) const;
 
-	bool                                   is_root_;
-	std::vector<std::shared_ptr<Hittable>> root_all_objects_; // only used for root node
+  private:
+	// Reordered during the build so that every leaf references a contiguous range
+	std::vector<std::shared_ptr<Hittable>> objects_;
+	std::vector<BvhNode>                   nodes_;
+
+	WideBvh wide_;
 
 	Aabb box_;
+
+	float sah_cost_{0.0f};
+	float build_time_{0.0f};
 };
-}        // namespace mengze
\ No newline at end of file
+}        // namespace mengze::rt
@@ -0,0 +1,271 @@
+#include "ray_tracing/bvh_builder.h"
+
+#include <algorithm>
+#include <future>
+#include <numeric>
+
+namespace mengze::rt
+{
+namespace
+{
+struct Bin
+{
+	glm::vec3 min{std::numeric_limits<float>::infinity()};
+	glm::vec3 max{-std::numeric_limits<float>::infinity()};
+	uint32_t  count{0};
+};
+
+float half_area(const glm::vec3 &min, const glm::vec3 &max)
+{
+	glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+}        // namespace
+
+BvhBuilder::BvhBuilder(const BvhBuildOptions &options) :
+    options_(options)
+{
+	options_.bin_count     = std::clamp(options_.bin_count, 2, MAX_BIN_COUNT);
+	options_.max_leaf_size = std::clamp(options_.max_leaf_size, 1, static_cast<int>(std::numeric_limits<uint16_t>::max()));
+	// 32 levels of median splits separate any 32 bit primitive count, so the forced leaves at max_depth hold one each
+	options_.max_depth     = std::clamp(options_.max_depth, 32, MAX_BVH_DEPTH);
+}
+
+void BvhBuilder::build(const std::vector<Aabb> &primitive_bounds, std::vector<BvhNode> &nodes, std::vector<uint32_t> &primitive_indices)
+{
+	nodes.clear();
+	primitive_indices.clear();
+
+	auto primitive_count = static_cast<uint32_t>(primitive_bounds.size());
+	if (primitive_count == 0)
+	{
+		return;
+	}
+
+	bounds_min_.resize(primitive_count);
+	bounds_max_.resize(primitive_count);
+	centroids_.resize(primitive_count);
+	for (uint32_t i = 0; i < primitive_count; ++i)
+	{
+		bounds_min_[i] = primitive_bounds[i].min();
+		bounds_max_[i] = primitive_bounds[i].max();
+		centroids_[i]  = 0.5f * (bounds_min_[i] + bounds_max_[i]);
+	}
+
+	indices_.resize(primitive_count);
+	std::iota(indices_.begin(), indices_.end(), 0u);
+
+	nodes.reserve(2 * primitive_count / options_.max_leaf_size + 1);
+	build_recursive(nodes, 0, primitive_count, 0);
+	nodes.shrink_to_fit();
+
+	primitive_indices = std::move(indices_);
+
+	bounds_min_.clear();
+	bounds_max_.clear();
+	centroids_.clear();
+	indices_.clear();
+}
+
+float BvhBuilder::sah_cost(const std::vector<BvhNode> &nodes) const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+
+	float root_area = std::max(half_area(nodes[0].min, nodes[0].max), std::numeric_limits<float>::min());
+	float cost      = 0.0f;
+	for (const auto &node : nodes)
+	{
+		float area = half_area(node.min, node.max) / root_area;
+		cost += node.is_leaf() ? area * node.count * options_.intersection_cost : area * options_.traversal_cost;
+	}
+	return cost;
+}
+
+void BvhBuilder::build_recursive(std::vector<BvhNode> &nodes, uint32_t begin, uint32_t end, int depth)
+{
+	auto node_index = nodes.size();
+	nodes.emplace_back();
+
+	glm::vec3 node_min(std::numeric_limits<float>::infinity());
+	glm::vec3 node_max(-std::numeric_limits<float>::infinity());
+	glm::vec3 centroid_min(std::numeric_limits<float>::infinity());
+	glm::vec3 centroid_max(-std::numeric_limits<float>::infinity());
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		auto primitive = indices_[i];
+		node_min       = glm::min(node_min, bounds_min_[primitive]);
+		node_max       = glm::max(node_max, bounds_max_[primitive]);
+		centroid_min   = glm::min(centroid_min, centroids_[primitive]);
+		centroid_max   = glm::max(centroid_max, centroids_[primitive]);
+	}
+
+	nodes[node_index].min = node_min;
+	nodes[node_index].max = node_max;
+
+	auto count     = end - begin;
+	auto make_leaf = [&]() {
+		nodes[node_index].offset = begin;
+		nodes[node_index].count  = static_cast<uint16_t>(count);
+	};
+
+	int remaining_depth = options_.max_depth - depth;
+	if (count == 1 || remaining_depth <= 0)
+	{
+		make_leaf();
+		return;
+	}
+
+	// Median splits halve the node every level, switching to them once the node holds more primitives
+	// than half the remaining levels can separate guarantees single primitive leaves at max_depth
+	bool force_median = remaining_depth <= 32 && count > (uint64_t{1} << (remaining_depth - 1));
+
+	int   axis      = 0;
+	int   split_bin = 0;
+	float split_cost;
+	bool  has_split = !force_median &&
+	                 find_split(begin, end, centroid_min, centroid_max, half_area(node_min, node_max), axis, split_bin, split_cost);
+
+	float leaf_cost = count * options_.intersection_cost;
+	if (count <= static_cast<uint32_t>(options_.max_leaf_size) && (force_median || !has_split || split_cost >= leaf_cost))
+	{
+		make_leaf();
+		return;
+	}
+
+	uint32_t mid;
+	if (has_split)
+	{
+		auto it = std::partition(indices_.begin() + begin, indices_.begin() + end, [&](uint32_t primitive) {
+			return bin_index(primitive, axis, centroid_min, centroid_max) < split_bin;
+		});
+		mid     = static_cast<uint32_t>(it - indices_.begin());
+	}
+	else
+	{
+		// Object median along the widest centroid extent, if all centroids coincide any split is as good
+		// as another
+		glm::vec3 extent = centroid_max - centroid_min;
+		axis             = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+		mid              = begin + count / 2;
+		std::nth_element(indices_.begin() + begin, indices_.begin() + mid, indices_.begin() + end, [&](uint32_t a, uint32_t b) {
+			return centroids_[a][axis] < centroids_[b][axis];
+		});
+	}
+
+	uint32_t second_child;
+	if (depth < MAX_PARALLEL_DEPTH && count > 1024)
+	{
+		// Both halves work on disjoint ranges of indices_, so they can be built into separate arrays
+		// and spliced behind the parent afterwards
+		std::vector<BvhNode> left_nodes;
+		std::vector<BvhNode> right_nodes;
+
+		auto future_left = std::async(std::launch::async, [&]() {
+			build_recursive(left_nodes, begin, mid, depth + 1);
+		});
+		build_recursive(right_nodes, mid, end, depth + 1);
+		future_left.get();
+
+		append_subtree(nodes, left_nodes);
+		second_child = static_cast<uint32_t>(nodes.size());
+		append_subtree(nodes, right_nodes);
+	}
+	else
+	{
+		build_recursive(nodes, begin, mid, depth + 1);
+		second_child = static_cast<uint32_t>(nodes.size());
+		build_recursive(nodes, mid, end, depth + 1);
+	}
+
+	auto &node  = nodes[node_index];
+	node.offset = second_child;
+	node.count  = 0;
+	node.axis   = static_cast<uint8_t>(axis);
+}
+
+bool BvhBuilder::find_split(uint32_t begin, uint32_t end, const glm::vec3 &centroid_min, const glm::vec3 &centroid_max,
+                            float node_area, int &best_axis, int &best_bin, float &best_cost) const
+{
+	const int bin_count = options_.bin_count;
+	node_area           = std::max(node_area, std::numeric_limits<float>::min());
+	best_cost           = std::numeric_limits<float>::infinity();
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (centroid_max[axis] <= centroid_min[axis])
+		{
+			continue;
+		}
+
+		Bin bins[MAX_BIN_COUNT];
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			auto primitive = indices_[i];
+			auto &bin      = bins[bin_index(primitive, axis, centroid_min, centroid_max)];
+			bin.min        = glm::min(bin.min, bounds_min_[primitive]);
+			bin.max        = glm::max(bin.max, bounds_max_[primitive]);
+			bin.count++;
+		}
+
+		// Sweep from the right to get the area and count of every suffix
+		float    right_area[MAX_BIN_COUNT];
+		uint32_t right_count[MAX_BIN_COUNT];
+		Bin      right;
+		for (int b = bin_count - 1; b > 0; --b)
+		{
+			right.min = glm::min(right.min, bins[b].min);
+			right.max = glm::max(right.max, bins[b].max);
+			right.count += bins[b].count;
+			right_area[b]  = half_area(right.min, right.max);
+			right_count[b] = right.count;
+		}
+
+		Bin left;
+		for (int b = 1; b < bin_count; ++b)
+		{
+			left.min = glm::min(left.min, bins[b - 1].min);
+			left.max = glm::max(left.max, bins[b - 1].max);
+			left.count += bins[b - 1].count;
+
+			if (left.count == 0 || right_count[b] == 0)
+			{
+				continue;
+			}
+
+			float cost = options_.traversal_cost +
+			             options_.intersection_cost * (half_area(left.min, left.max) * left.count + right_area[b] * right_count[b]) / node_area;
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin  = b;
+			}
+		}
+	}
+
+	return best_cost < std::numeric_limits<float>::infinity();
+}
+
+int BvhBuilder::bin_index(uint32_t primitive, int axis, const glm::vec3 &centroid_min, const glm::vec3 &centroid_max) const
+{
+	float extent = centroid_max[axis] - centroid_min[axis];
+	auto  index  = static_cast<int>(options_.bin_count * (centroids_[primitive][axis] - centroid_min[axis]) / extent);
+	return std::clamp(index, 0, options_.bin_count - 1);
+}
+
+void BvhBuilder::append_subtree(std::vector<BvhNode> &nodes, const std::vector<BvhNode> &subtree)
+{
+	auto base = static_cast<uint32_t>(nodes.size());
+	for (auto node : subtree)
+	{
+		if (!node.is_leaf())
+		{
+			node.offset += base;
+		}
+		nodes.push_back(node);
+	}
+}
+}        // namespace mengze::rt
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/aabb.h"
+
+namespace mengze::rt
+{
+// Nodes are stored in depth-first order, so the first child of an interior node is always the next
+// node in the array and only the second child needs an explicit index.
+struct alignas(32) BvhNode
+{
+	glm::vec3 min;
+	uint32_t  offset;        // leaf: index of the first primitive, interior: index of the second child
+	glm::vec3 max;
+	uint16_t  count;         // number of primitives in a leaf, 0 for interior nodes
+	uint8_t   axis;
+	uint8_t   pad;
+
+	bool is_leaf() const
+	{
+		return count > 0;
+	}
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode should fit in half a cache line");
+
+// Upper bound for BvhBuildOptions::max_depth, the traversal stacks are sized against it
+constexpr int MAX_BVH_DEPTH = 62;
+
+struct BvhBuildOptions
+{
+	int   bin_count{16};
+	int   max_leaf_size{4};
+	float traversal_cost{1.0f};
+	float intersection_cost{1.0f};
+	int   max_depth{48};        // nodes this deep become leaves, median splits are used on the way there
+};
+
+/**
+ * @brief Binned surface area heuristic builder.
+ *
+ * Works on precomputed primitive bounds only, so the same builder serves every primitive type. The
+ * result is a flattened node array plus the order in which leaves reference the primitives.
+ */
+class BvhBuilder
+{
+  public:
+	explicit BvhBuilder(const BvhBuildOptions &options = {});
+
+	void build(const std::vector<Aabb> &primitive_bounds, std::vector<BvhNode> &nodes, std::vector<uint32_t> &primitive_indices);
+
+	// Expected cost of a random ray relative to the root, using the builder's cost constants
+	float sah_cost(const std::vector<BvhNode> &nodes) const;
+
+  private:
+	void build_recursive(std::vector<BvhNode> &nodes, uint32_t begin, uint32_t end, int depth);
+
+	bool find_split(uint32_t begin, uint32_t end, const glm::vec3 &centroid_min, const glm::vec3 &centroid_max,
+	                float node_area, int &best_axis, int &best_bin, float &best_cost) const;
+
+	int bin_index(uint32_t primitive, int axis, const glm::vec3 &centroid_min, const glm::vec3 &centroid_max) const;
+
+	static void append_subtree(std::vector<BvhNode> &nodes, const std::vector<BvhNode> &subtree);
+
+  private:
+	static constexpr int MAX_BIN_COUNT      = 32;
+	static constexpr int MAX_PARALLEL_DEPTH = 5;
+
+	BvhBuildOptions options_;
+
+	std::vector<glm::vec3> bounds_min_;
+	std::vector<glm::vec3> bounds_max_;
+	std::vector<glm::vec3> centroids_;
+	std::vector<uint32_t>  indices_;
+};
+}        // namespace mengze::rt
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/bvh_builder.h"
+#include "ray_tracing/math.h"
+#include "ray_tracing/ray.h"
+#include "ray_tracing/ray_packet.h"
+
+// Traversal of the binary node array produced by BvhBuilder, shared by every hittable that owns one.
+// Leaves are handed to a callback so the primitive storage stays up to the caller.
+namespace mengze::rt::bvh
+{
+constexpr int MAX_STACK_DEPTH = 64;
+
+// The packet traversal pushes both children of every node on the path, one more entry than the depth
+static_assert(MAX_BVH_DEPTH + 2 <= MAX_STACK_DEPTH, "BvhBuilder may produce trees the traversal stack cannot hold");
+
+inline bool intersect_node(const BvhNode &node, const glm::vec3 &origin, const glm::vec3 &inv_direction, const Interval &ray_t)
+{
+	auto t0 = (node.min - origin) * inv_direction;
+	auto t1 = (node.max - origin) * inv_direction;
+
+	auto t_near = glm::min(t0, t1);
+	auto t_far  = glm::max(t0, t1);
+
+	auto t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, ray_t.min()));
+	auto t_exit  = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, ray_t.max()));
+
+	return t_enter <= t_exit;
+}
+
+// Returns the entry distance, or infinity when the ray misses the node within ray_t
+inline float intersect_node(const BvhNode &node, const Ray &r, const Interval &ray_t)
+{
+	const auto &origin        = r.origin();
+	const auto &inv_direction = r.inv_direction();
+
+	// The cached sign picks the near and far plane per axis, no min/max needed
+	float t_enter_x = ((r.sign(0) ? node.max.x : node.min.x) - origin.x) * inv_direction.x;
+	float t_exit_x  = ((r.sign(0) ? node.min.x : node.max.x) - origin.x) * inv_direction.x;
+	float t_enter_y = ((r.sign(1) ? node.max.y : node.min.y) - origin.y) * inv_direction.y;
+	float t_exit_y  = ((r.sign(1) ? node.min.y : node.max.y) - origin.y) * inv_direction.y;
+	float t_enter_z = ((r.sign(2) ? node.max.z : node.min.z) - origin.z) * inv_direction.z;
+	float t_exit_z  = ((r.sign(2) ? node.min.z : node.max.z) - origin.z) * inv_direction.z;
+
+	float t_enter = std::max(std::max(t_enter_x, t_enter_y), std::max(t_enter_z, ray_t.min()));
+	float t_exit  = std::min(std::min(t_exit_x, t_exit_y), std::min(t_exit_z, ray_t.max()));
+
+	return t_enter <= t_exit ? t_enter : std::numeric_limits<float>::infinity();
+}
+
+// Returns the subset of lanes that hit the node
+inline LaneMask intersect_node(const BvhNode &node, const RayPacket &packet, LaneMask lanes)
+{
+	// If the first active lane hits, the node is visited with every lane and the per-lane tests are
+	// left to the children
+	int first = lowest_lane(lanes);
+	if (intersect_node(node, packet.rays[first].origin(), packet.rays[first].inv_direction(), Interval(packet.t_min, packet.t_max[first])))
+	{
+		return lanes;
+	}
+
+	float max_t = packet.t_min;
+	for (LaneMask m = lanes; m; m &= m - 1)
+	{
+		max_t = std::max(max_t, packet.t_max[lowest_lane(m)]);
+	}
+	if (!packet.may_hit(node.min, node.max, max_t))
+	{
+		return 0;
+	}
+
+	LaneMask hit_lanes = 0;
+	for (LaneMask m = lanes & (lanes - 1); m; m &= m - 1)
+	{
+		int lane = lowest_lane(m);
+		if (intersect_node(node, packet.rays[lane].origin(), packet.rays[lane].inv_direction(), Interval(packet.t_min, packet.t_max[lane])))
+		{
+			hit_lanes |= LaneMask{1} << lane;
+		}
+	}
+	return hit_lanes;
+}
+
+/**
+ * @brief Closest-first traversal: of two hit children the nearer one is visited next and the other
+ *        is pushed with its entry distance, so it is dropped once a closer hit has been found.
+ * @param intersect_leaf bool(uint32_t first, uint32_t count, Interval &ray_t), shrinks ray_t.max()
+ *        and returns true when a primitive of the leaf was hit
+ */
+template <typename LeafIntersector>
+bool intersect(const std::vector<BvhNode> &nodes, const Ray &r, Interval &ray_t, LeafIntersector &&intersect_leaf)
+{
+	if (nodes.empty() || intersect_node(nodes[0], r, ray_t) == std::numeric_limits<float>::infinity())
+	{
+		return false;
+	}
+
+	struct StackEntry
+	{
+		uint32_t index;
+		float    t;
+	};
+
+	StackEntry stack[MAX_STACK_DEPTH];
+	int        stack_size   = 0;
+	uint32_t   node_index   = 0;
+	bool       hit_anything = false;
+
+	while (true)
+	{
+		const auto &node = nodes[node_index];
+
+		if (node.is_leaf())
+		{
+			hit_anything |= intersect_leaf(node.offset, node.count, ray_t);
+		}
+		else
+		{
+			uint32_t near_child = node_index + 1;
+			uint32_t far_child  = node.offset;
+			float    t_near     = intersect_node(nodes[near_child], r, ray_t);
+			float    t_far      = intersect_node(nodes[far_child], r, ray_t);
+			if (t_far < t_near)
+			{
+				std::swap(near_child, far_child);
+				std::swap(t_near, t_far);
+			}
+
+			if (t_near != std::numeric_limits<float>::infinity())
+			{
+				if (t_far != std::numeric_limits<float>::infinity())
+				{
+					assert(stack_size < MAX_STACK_DEPTH);
+					stack[stack_size++] = {far_child, t_far};
+				}
+				node_index = near_child;
+				continue;
+			}
+		}
+
+		// Pop the next subtree that still starts before the closest hit
+		while (stack_size > 0 && stack[stack_size - 1].t > ray_t.max())
+		{
+			--stack_size;
+		}
+		if (stack_size == 0)
+		{
+			break;
+		}
+		node_index = stack[--stack_size].index;
+	}
+
+	return hit_anything;
+}
+
+/**
+ * @brief Any-hit traversal for visibility queries. Children are ordered by the ray direction on the
+ *        split axis, which needs neither entry distances nor sorting, and the first hit ends the walk.
+ * @param occluded_leaf bool(uint32_t first, uint32_t count), true when any primitive of the leaf is hit
+ */
+template <typename LeafOccluder>
+bool occluded(const std::vector<BvhNode> &nodes, const Ray &r, const Interval &ray_t, LeafOccluder &&occluded_leaf)
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	uint32_t stack[MAX_STACK_DEPTH];
+	int      stack_size = 0;
+	uint32_t node_index = 0;
+
+	while (true)
+	{
+		const auto &node = nodes[node_index];
+
+		if (intersect_node(node, r, ray_t) != std::numeric_limits<float>::infinity())
+		{
+			if (node.is_leaf())
+			{
+				if (occluded_leaf(node.offset, node.count))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				uint32_t near_child = node_index + 1;
+				uint32_t far_child  = node.offset;
+				if (r.sign(node.axis))
+				{
+					std::swap(near_child, far_child);
+				}
+
+				assert(stack_size < MAX_STACK_DEPTH);
+				stack[stack_size++] = far_child;
+				node_index          = near_child;
+				continue;
+			}
+		}
+
+		if (stack_size == 0)
+		{
+			break;
+		}
+		node_index = stack[--stack_size];
+	}
+
+	return false;
+}
+
+/**
+ * @param intersect_leaf LaneMask(uint32_t first, uint32_t count, LaneMask lanes), updates the packet's
+ *        t_max and returns the lanes that hit a primitive of the leaf
+ */
+template <typename LeafIntersector>
+LaneMask intersect_packet(const std::vector<BvhNode> &nodes, const RayPacket &packet, LaneMask active, LeafIntersector &&intersect_leaf)
+{
+	if (nodes.empty() || !active)
+	{
+		return 0;
+	}
+
+	struct StackEntry
+	{
+		uint32_t index;
+		LaneMask lanes;
+	};
+
+	StackEntry stack[MAX_STACK_DEPTH];
+	int        stack_size = 0;
+	LaneMask   hits       = 0;
+
+	stack[stack_size++] = {0, active};
+
+	while (stack_size > 0)
+	{
+		auto        entry = stack[--stack_size];
+		const auto &node  = nodes[entry.index];
+
+		LaneMask lanes = intersect_node(node, packet, entry.lanes);
+		if (!lanes)
+		{
+			continue;
+		}
+
+		if (node.is_leaf())
+		{
+			hits |= intersect_leaf(node.offset, node.count, lanes);
+			continue;
+		}
+
+		// The packet is coherent, so the near child of the first active lane is near for most lanes
+		uint32_t near_child = entry.index + 1;
+		uint32_t far_child  = node.offset;
+		if (packet.rays[lowest_lane(lanes)].direction()[node.axis] < 0.0f)
+		{
+			std::swap(near_child, far_child);
+		}
+
+		assert(stack_size + 1 < MAX_STACK_DEPTH);
+		stack[stack_size++] = {far_child, lanes};
+		stack[stack_size++] = {near_child, lanes};
+	}
+
+	return hits;
+}
+}        // namespace mengze::rt::bvh
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cmath>
 #include <random>
 #include <iostream>
 
@@ -10,6 +11,7 @@
 #include "ray_tracing/hittable.h"
 #include "rendering/camera.h"
 #include "ray_tracing/math.h"
+#include "ray_tracing/sampler.h"
 
 namespace mengze::rt
 {
@@ -21,10 +23,10 @@ class Camera : public mengze::Camera
 	Camera(glm::vec3 position, glm::vec3 look_at, glm::vec3 up, float fov);
 
 
-	Ray get_ray(float i, float j) const
+	Ray get_ray(float i, float j, Sampler &sampler) const
 	{
 		auto pixel_center = pixel00_loc_ + (i * pixel_delta_u_) + (j * pixel_delta_v_);
-		auto pixel_sample = pixel_center + pixel_sample_square();
+		auto pixel_sample = pixel_center + pixel_sample_square(sampler);
 
 		auto ray_origin    = position_;
 		auto ray_direction = pixel_sample - ray_origin;
@@ -32,6 +34,53 @@ class Camera : public mengze::Camera
 		return Ray(ray_origin, ray_direction);
 	}
 
+	glm::vec3 position() const
+	{
+		return position_;
+	}
+
+	// Height of a pixel's footprint at unit distance from the camera
+	float pixel_spread() const
+	{
+		return 2.0f * glm::tan(glm::radians(fov_) / 2.0f) / static_cast<float>(viewport_height_);
+	}
+
+	// Area of the image at unit distance from the camera
+	float image_area() const
+	{
+		float spread = pixel_spread();
+		return spread * spread * static_cast<float>(viewport_width_) * static_cast<float>(viewport_height_);
+	}
+
+	// Cosine between the view direction and the direction towards p
+	float view_cosine(const glm::vec3 &p) const
+	{
+		return -glm::dot(w_, glm::normalize(p - position_));
+	}
+
+	// Pixel that sees p as get_ray() samples it, false when p is behind the camera or outside the image
+	bool raster_position(const glm::vec3 &p, uint32_t &x, uint32_t &y) const
+	{
+		glm::vec3 direction = p - position_;
+		float     depth     = -glm::dot(direction, w_);
+		if (depth <= 0.0f)
+		{
+			return false;
+		}
+
+		glm::vec3 offset = position_ + direction * (focus_distance_ / depth) - pixel00_loc_;
+		float     i      = std::floor(glm::dot(offset, pixel_delta_u_) / glm::dot(pixel_delta_u_, pixel_delta_u_) + 0.5f);
+		float     j      = std::floor(glm::dot(offset, pixel_delta_v_) / glm::dot(pixel_delta_v_, pixel_delta_v_) + 0.5f);
+		if (i < 0.0f || j < 0.0f || i >= static_cast<float>(viewport_width_) || j >= static_cast<float>(viewport_height_))
+		{
+			return false;
+		}
+
+		x = static_cast<uint32_t>(i);
+		y = static_cast<uint32_t>(j);
+		return true;
+	}
+
 	void initialize()
 	{
 		auto theta = glm::radians(fov_);
@@ -60,10 +109,11 @@ class Camera : public mengze::Camera
 
   private:
 
-	glm::vec3 pixel_sample_square() const
+	glm::vec3 pixel_sample_square(Sampler &sampler) const
 	{
-		float px = -0.5f + random_float(0.0f, 1.0f);
-		float py = -0.5f + random_float(0.0f, 1.0f);
+		glm::vec2 u  = sampler.get_2d();
+		float     px = -0.5f + u.x;
+		float     py = -0.5f + u.y;
 
 		return (px * pixel_delta_u_) + (py * pixel_delta_v_);
 	}
@@ -0,0 +1,203 @@
+#include "ray_tracing/environment_light.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <stb_image.h>
+
+#include "core/logging.h"
+#include "ray_tracing/material.h"
+
+namespace mengze::rt
+{
+PiecewiseConstant2D::PiecewiseConstant2D(const std::vector<float> &values, int width, int height) :
+    values_(values), width_(width), height_(height)
+{
+	zero_ = std::all_of(values_.begin(), values_.end(), [](float value) { return value <= 0.0f; });
+	if (zero_)
+	{
+		std::fill(values_.begin(), values_.end(), 1.0f);
+	}
+
+	conditional_cdfs_.resize(static_cast<size_t>(height_) * (width_ + 1));
+	row_integrals_.resize(height_);
+	for (int y = 0; y < height_; ++y)
+	{
+		const float *row = values_.data() + static_cast<size_t>(y) * width_;
+		float       *cdf = conditional_cdfs_.data() + static_cast<size_t>(y) * (width_ + 1);
+		cdf[0]           = 0.0f;
+		for (int x = 0; x < width_; ++x)
+		{
+			cdf[x + 1] = cdf[x] + row[x] / static_cast<float>(width_);
+		}
+		row_integrals_[y] = cdf[width_];
+	}
+
+	marginal_cdf_.resize(height_ + 1);
+	marginal_cdf_[0] = 0.0f;
+	for (int y = 0; y < height_; ++y)
+	{
+		marginal_cdf_[y + 1] = marginal_cdf_[y] + row_integrals_[y] / static_cast<float>(height_);
+	}
+	integral_ = marginal_cdf_[height_];
+}
+
+float PiecewiseConstant2D::sample_continuous(const float *cdf, int count, float u, int &index)
+{
+	// Last cell whose CDF entry is at most the scaled u, cells of width 0 are never picked
+	float target = u * cdf[count];
+	index        = static_cast<int>(std::upper_bound(cdf, cdf + count + 1, target) - cdf) - 1;
+	index        = std::clamp(index, 0, count - 1);
+	while (index > 0 && cdf[index + 1] <= cdf[index])
+	{
+		--index;
+	}
+
+	float width  = cdf[index + 1] - cdf[index];
+	float offset = width > 0.0f ? (target - cdf[index]) / width : 0.0f;
+	return std::min((static_cast<float>(index) + std::clamp(offset, 0.0f, 1.0f)) / static_cast<float>(count), 0.99999994f);
+}
+
+glm::vec2 PiecewiseConstant2D::sample(const glm::vec2 &u, float &pdf) const
+{
+	int row    = 0;
+	int column = 0;
+	float y    = sample_continuous(marginal_cdf_.data(), height_, u.y, row);
+	float x    = sample_continuous(conditional_cdfs_.data() + static_cast<size_t>(row) * (width_ + 1), width_, u.x, column);
+	pdf        = values_[static_cast<size_t>(row) * width_ + column] / integral_;
+	return {x, y};
+}
+
+float PiecewiseConstant2D::pdf(const glm::vec2 &p) const
+{
+	int x = std::clamp(static_cast<int>(p.x * static_cast<float>(width_)), 0, width_ - 1);
+	int y = std::clamp(static_cast<int>(p.y * static_cast<float>(height_)), 0, height_ - 1);
+	return values_[static_cast<size_t>(y) * width_ + x] / integral_;
+}
+
+float PiecewiseConstant2D::mean() const
+{
+	return zero_ ? 0.0f : integral_;
+}
+
+EnvironmentLight::EnvironmentLight(const std::string &filename, float scale) :
+    scale_(scale)
+{
+	int    components = 3;
+	float *data       = stbi_loadf(filename.c_str(), &width_, &height_, &components, 3);
+	if (!data)
+	{
+		LOGE("Failed to load environment map: {}", filename)
+		width_ = height_ = 0;
+		return;
+	}
+
+	radiance_.resize(static_cast<size_t>(width_) * height_);
+	for (size_t i = 0; i < radiance_.size(); ++i)
+	{
+		radiance_[i] = {data[3 * i], data[3 * i + 1], data[3 * i + 2]};
+	}
+	stbi_image_free(data);
+	build_distribution();
+}
+
+EnvironmentLight::EnvironmentLight(std::vector<glm::vec3> radiance, int width, int height, float scale) :
+    radiance_(std::move(radiance)), width_(width), height_(height), scale_(scale)
+{
+	build_distribution();
+}
+
+void EnvironmentLight::build_distribution()
+{
+	if (width_ <= 0 || height_ <= 0)
+	{
+		return;
+	}
+
+	// Rows near the poles cover less solid angle, the mean of sin(theta) over a row makes its cells weigh
+	// as much as the solid angle they map to
+	std::vector<float> values(radiance_.size());
+	for (int y = 0; y < height_; ++y)
+	{
+		float theta0    = glm::pi<float>() * static_cast<float>(y) / static_cast<float>(height_);
+		float theta1    = glm::pi<float>() * static_cast<float>(y + 1) / static_cast<float>(height_);
+		float sin_theta = (std::cos(theta0) - std::cos(theta1)) / (theta1 - theta0);
+		for (int x = 0; x < width_; ++x)
+		{
+			size_t index  = static_cast<size_t>(y) * width_ + x;
+			values[index] = std::max(rgb_to_luminance(radiance_[index]), 0.0f) * sin_theta;
+		}
+	}
+	distribution_ = PiecewiseConstant2D(values, width_, height_);
+}
+
+glm::vec3 EnvironmentLight::radiance(const glm::vec3 &direction) const
+{
+	if (radiance_.empty())
+	{
+		return glm::vec3{0.0f};
+	}
+
+	glm::vec3 d     = glm::normalize(direction);
+	float     phi   = std::atan2(d.z, d.x);
+	float     u     = (phi < 0.0f ? phi + 2.0f * glm::pi<float>() : phi) / (2.0f * glm::pi<float>());
+	float     v     = std::acos(std::clamp(d.y, -1.0f, 1.0f)) / glm::pi<float>();
+	int       x     = std::clamp(static_cast<int>(u * static_cast<float>(width_)), 0, width_ - 1);
+	int       y     = std::clamp(static_cast<int>(v * static_cast<float>(height_)), 0, height_ - 1);
+	return radiance_[static_cast<size_t>(y) * width_ + x] * scale_;
+}
+
+bool EnvironmentLight::sample(const glm::vec2 &u, glm::vec3 &direction, float &pdf) const
+{
+	if (radiance_.empty())
+	{
+		return false;
+	}
+
+	float     uv_pdf;
+	glm::vec2 uv        = distribution_.sample(u, uv_pdf);
+	float     theta     = uv.y * glm::pi<float>();
+	float     phi       = uv.x * 2.0f * glm::pi<float>();
+	float     sin_theta = std::sin(theta);
+	if (uv_pdf <= 0.0f || sin_theta <= 0.0f)
+	{
+		return false;
+	}
+
+	direction = {sin_theta * std::cos(phi), std::cos(theta), sin_theta * std::sin(phi)};
+	pdf       = uv_pdf / (2.0f * glm::pi<float>() * glm::pi<float>() * sin_theta);
+	return true;
+}
+
+float EnvironmentLight::pdf(const glm::vec3 &direction) const
+{
+	if (radiance_.empty())
+	{
+		return 0.0f;
+	}
+
+	glm::vec3 d         = glm::normalize(direction);
+	float     cos_theta = std::clamp(d.y, -1.0f, 1.0f);
+	float     sin_theta = std::sqrt(std::max(1.0f - cos_theta * cos_theta, 0.0f));
+	if (sin_theta <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	float phi = std::atan2(d.z, d.x);
+	float u   = (phi < 0.0f ? phi + 2.0f * glm::pi<float>() : phi) / (2.0f * glm::pi<float>());
+	float v   = std::acos(cos_theta) / glm::pi<float>();
+	return distribution_.pdf({u, v}) / (2.0f * glm::pi<float>() * glm::pi<float>() * sin_theta);
+}
+
+float EnvironmentLight::total_luminance() const
+{
+	if (radiance_.empty())
+	{
+		return 0.0f;
+	}
+
+	// The distribution's mean is the luminance integrated over the sphere in units of the (phi, theta) square's area, 2 pi^2
+	return distribution_.mean() * 2.0f * glm::pi<float>() * glm::pi<float>() * scale_;
+}
+}        // namespace mengze::rt
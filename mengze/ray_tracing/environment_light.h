@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace mengze::rt
+{
+/**
+ * @brief Piecewise constant density over the unit square, one value per cell of a width by height grid.
+ *
+ * Rows are picked from the marginal CDF and the column from the row's conditional CDF, both by binary
+ * search. The density of a point is read from its cell, so evaluating it costs no search.
+ */
+class PiecewiseConstant2D
+{
+  public:
+	PiecewiseConstant2D() = default;
+
+	// values are row major and non-negative, a grid that is all zero is sampled uniformly
+	PiecewiseConstant2D(const std::vector<float> &values, int width, int height);
+
+	// Point in [0, 1)^2 and its density with respect to area on the square
+	glm::vec2 sample(const glm::vec2 &u, float &pdf) const;
+
+	float pdf(const glm::vec2 &p) const;
+
+	// Mean of the values over the grid, 0 for a grid that is all zero
+	float mean() const;
+
+  private:
+	// Position in [0, 1) of u within the CDF of count cells starting at cdf, its cell is written to index
+	static float sample_continuous(const float *cdf, int count, float u, int &index);
+
+	std::vector<float> values_;
+	std::vector<float> conditional_cdfs_;        // height rows of width + 1 entries
+	std::vector<float> row_integrals_;
+	std::vector<float> marginal_cdf_;            // height + 1 entries
+	float              integral_{0.0f};
+	bool               zero_{false};        // all values were 0 and sampling fell back to uniform
+	int                width_{0};
+	int                height_{0};
+};
+
+/**
+ * @brief Radiance arriving from infinitely far away in every direction, stored as an equirectangular
+ * image with +y at the top row.
+ *
+ * Directions are importance sampled in proportion to the luminance of the image, weighted by the sine
+ * of the polar angle that the mapping stretches rows by, so the sampled density follows the radiance
+ * in solid angle. Missing images turn into a black environment.
+ */
+class EnvironmentLight
+{
+  public:
+	// Loads an HDR image through stb, its radiance is multiplied by scale
+	explicit EnvironmentLight(const std::string &filename, float scale = 1.0f);
+
+	EnvironmentLight(std::vector<glm::vec3> radiance, int width, int height, float scale = 1.0f);
+
+	glm::vec3 radiance(const glm::vec3 &direction) const;
+
+	// Normalized direction and its solid angle density, fails for directions of density 0
+	bool sample(const glm::vec2 &u, glm::vec3 &direction, float &pdf) const;
+
+	float pdf(const glm::vec3 &direction) const;
+
+	// Luminance integrated over the sphere of directions
+	float total_luminance() const;
+
+  private:
+	void build_distribution();
+
+	std::vector<glm::vec3> radiance_;
+	int                    width_{0};
+	int                    height_{0};
+	float                  scale_{1.0f};
+	PiecewiseConstant2D    distribution_;
+};
+}        // namespace mengze::rt
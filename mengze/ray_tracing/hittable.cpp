@@ -7,4 +7,25 @@ void HitRecord::set_face_normal(const Ray &r, const glm::vec3 &outward_normal)
 	front_face = glm::dot(r.direction(), outward_normal) < 0;
 	normal     = front_face ? outward_normal : -outward_normal;
 }
+
+bool Hittable::occluded(const Ray &r, Interval ray_t) const
+{
+	HitRecord rec;
+	return hit(r, ray_t, rec);
+}
+
+LaneMask Hittable::hit_packet(RayPacket &packet, LaneMask active, HitRecord *records) const
+{
+	LaneMask hits = 0;
+	for (; active; active &= active - 1)
+	{
+		int lane = lowest_lane(active);
+		if (hit(packet.rays[lane], Interval(packet.t_min, packet.t_max[lane]), records[lane]))
+		{
+			packet.t_max[lane] = records[lane].t;
+			hits |= LaneMask{1} << lane;
+		}
+	}
+	return hits;
+}
 }
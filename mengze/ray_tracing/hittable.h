@@ -1,14 +1,19 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include <glm/glm.hpp>
 
 #include "ray_tracing/material.h"
 #include "ray_tracing/ray.h"
+#include "ray_tracing/ray_packet.h"
 #include "ray_tracing/aabb.h"
 #include "ray_tracing/math.h"
 
 namespace mengze::rt
 {
+constexpr uint32_t INVALID_LIGHT_ID = UINT32_MAX;
 
 struct HitRecord
 {
@@ -20,11 +25,23 @@ struct HitRecord
 	float u;
 	float v;
 
+	uint32_t primitive_id;        // triangle within the object that was hit
+	uint32_t light_id;            // index into the scene's emitter table, INVALID_LIGHT_ID if not emissive
+
 	bool front_face;
 
 	void set_face_normal(const Ray &r, const glm::vec3 &outward_normal);
 };
 
+// Emissive triangle as seen by the light BVH, radiance is taken at the centroid
+struct Emitter
+{
+	glm::vec3 v0;
+	glm::vec3 edge1;
+	glm::vec3 edge2;
+	glm::vec3 radiance;
+};
+
 class Hittable
 {
   public:
@@ -39,38 +56,24 @@ class Hittable
 
 	virtual bool hit(const Ray &r, Interval ray_t, HitRecord &rec) const = 0;
 
-	virtual Aabb bounding_box() const = 0;
+	/**
+	 * @brief Any-hit query for shadow and visibility rays, returns as soon as something is hit within ray_t.
+	 *
+	 * No HitRecord is filled. The default falls back to hit().
+	 */
+	virtual bool occluded(const Ray &r, Interval ray_t) const;
 
-	virtual float pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const
-	{
-		return 0.0f;
-	}
+	/**
+	 * @brief Intersects the active lanes of a packet, ray i is limited to [packet.t_min, packet.t_max[i]].
+	 * @return The lanes that hit, their t_max and records are updated
+	 */
+	virtual LaneMask hit_packet(RayPacket &packet, LaneMask active, HitRecord *records) const;
 
-	virtual glm::vec3 random(const glm::vec3 &origin) const
-	{
-		return {1.0f, 0.0f, 0.0f};
-	}
-};
+	virtual Aabb bounding_box() const = 0;
 
-class HittablePdf : public Pdf
-{
-  public:
-	HittablePdf(Hittable &p, const glm::vec3 &origin) :
-	    p_(p), origin_(origin)
+	// Appends the emissive triangles of this object and remembers where they start, so hits can report
+	// their light_id. Lights that have none are left out of light sampling.
+	virtual void collect_emitters(std::vector<Emitter> &emitters)
 	{}
-
-	float value(const glm::vec3 &direction) const override
-	{
-		return p_.pdf_value(origin_, direction);
-	}
-
-	glm::vec3 generate() const override
-	{
-		return p_.random(origin_);
-	}
-
-  private:
-	Hittable &p_;
-	glm::vec3 origin_;
 };
 }        // namespace mengze::rt
@@ -0,0 +1,434 @@
+#include "ray_tracing/light_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/timer.h"
+#include "ray_tracing/bvh_traversal.h"
+
+namespace mengze::rt
+{
+namespace
+{
+constexpr float PI                = glm::pi<float>();
+constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+constexpr int BUCKET_COUNT   = 12;
+constexpr int MAX_TREE_DEPTH = 63;        // the trail of a leaf has one bit per level
+
+struct BuildEmitter
+{
+	glm::vec3   min;
+	glm::vec3   max;
+	glm::vec3   centroid;
+	LightBounds bounds;
+	uint32_t    index;
+};
+
+float safe_sqrt(float x)
+{
+	return std::sqrt(std::max(0.0f, x));
+}
+
+float safe_acos(float x)
+{
+	return std::acos(std::clamp(x, -1.0f, 1.0f));
+}
+
+glm::vec3 rotate(const glm::vec3 &v, const glm::vec3 &axis, float angle)
+{
+	// Rodrigues' formula, axis is normalized
+	float c = std::cos(angle);
+	float s = std::sin(angle);
+	return v * c + glm::cross(axis, v) * s + axis * glm::dot(axis, v) * (1.0f - c);
+}
+
+// Union of the power and the normal cones, an axis may be flipped since the emitters are two-sided
+LightBounds merge(const LightBounds &a, const LightBounds &b)
+{
+	if (a.power <= 0.0f)
+		return b;
+	if (b.power <= 0.0f)
+		return a;
+
+	LightBounds result;
+	result.power = a.power + b.power;
+
+	glm::vec3 axis_b  = glm::dot(a.axis, b.axis) < 0.0f ? -b.axis : b.axis;
+	float     theta_a = safe_acos(a.cos_theta_o);
+	float     theta_b = safe_acos(b.cos_theta_o);
+	float     theta_d = safe_acos(glm::dot(a.axis, axis_b));
+
+	if (std::min(theta_d + theta_b, PI) <= theta_a)
+	{
+		result.axis        = a.axis;
+		result.cos_theta_o = a.cos_theta_o;
+		return result;
+	}
+	if (std::min(theta_d + theta_a, PI) <= theta_b)
+	{
+		result.axis        = axis_b;
+		result.cos_theta_o = b.cos_theta_o;
+		return result;
+	}
+
+	float     theta_o       = 0.5f * (theta_a + theta_d + theta_b);
+	glm::vec3 rotation_axis = glm::cross(a.axis, axis_b);
+	if (theta_o >= PI || glm::dot(rotation_axis, rotation_axis) < 1e-12f)
+	{
+		result.axis        = a.axis;
+		result.cos_theta_o = -1.0f;
+		return result;
+	}
+
+	result.axis        = glm::normalize(rotate(a.axis, glm::normalize(rotation_axis), theta_o - theta_a));
+	result.cos_theta_o = std::cos(theta_o);
+	return result;
+}
+
+// Orientation term M_omega of the SAOH with theta_e = pi / 2 for diffuse emitters
+float orientation_measure(float cos_theta_o)
+{
+	float theta_o     = safe_acos(cos_theta_o);
+	float theta_w     = std::min(theta_o + 0.5f * PI, PI);
+	float sin_theta_o = std::sin(theta_o);
+	return 2.0f * PI * (1.0f - cos_theta_o) +
+	       0.5f * PI * (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_theta_o + cos_theta_o);
+}
+
+float surface_area(const glm::vec3 &min, const glm::vec3 &max)
+{
+	glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+}
+
+float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+}
+
+struct Bucket
+{
+	glm::vec3   min{std::numeric_limits<float>::max()};
+	glm::vec3   max{-std::numeric_limits<float>::max()};
+	LightBounds bounds;
+	uint32_t    count{0};
+
+	void add(const glm::vec3 &other_min, const glm::vec3 &other_max, const LightBounds &other_bounds, uint32_t other_count)
+	{
+		min    = glm::min(min, other_min);
+		max    = glm::max(max, other_max);
+		bounds = merge(bounds, other_bounds);
+		count += other_count;
+	}
+
+	float cost() const
+	{
+		return bounds.power * orientation_measure(bounds.cos_theta_o) * surface_area(min, max);
+	}
+};
+
+uint32_t build_recursive(std::vector<BuildEmitter> &emitters, uint32_t begin, uint32_t end, int depth,
+                         std::vector<BvhNode> &nodes, std::vector<LightBounds> &node_bounds)
+{
+	auto index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	node_bounds.emplace_back();
+
+	Bucket    node;
+	glm::vec3 centroid_min{std::numeric_limits<float>::max()};
+	glm::vec3 centroid_max{-std::numeric_limits<float>::max()};
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		node.add(emitters[i].min, emitters[i].max, emitters[i].bounds, 1);
+		centroid_min = glm::min(centroid_min, emitters[i].centroid);
+		centroid_max = glm::max(centroid_max, emitters[i].centroid);
+	}
+	nodes[index].min   = node.min;
+	nodes[index].max   = node.max;
+	node_bounds[index] = node.bounds;
+
+	auto make_leaf = [&]() {
+		nodes[index].offset = begin;
+		nodes[index].count  = static_cast<uint16_t>(end - begin);
+		return index;
+	};
+
+	uint32_t count = end - begin;
+	if (count == 1 || depth >= MAX_TREE_DEPTH)
+	{
+		return make_leaf();
+	}
+
+	// Binned SAOH, the regularization factor favours splitting along the longest axis
+	glm::vec3 extent     = node.max - node.min;
+	float     max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+	float     best_cost  = std::numeric_limits<float>::infinity();
+	int       best_axis  = -1;
+	int       best_split = 0;
+
+	auto bucket_of = [&](const BuildEmitter &emitter, int axis) {
+		float offset = (emitter.centroid[axis] - centroid_min[axis]) / (centroid_max[axis] - centroid_min[axis]);
+		return std::min(static_cast<int>(offset * BUCKET_COUNT), BUCKET_COUNT - 1);
+	};
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (centroid_max[axis] <= centroid_min[axis])
+			continue;
+
+		Bucket buckets[BUCKET_COUNT];
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			buckets[bucket_of(emitters[i], axis)].add(emitters[i].min, emitters[i].max, emitters[i].bounds, 1);
+		}
+
+		float regularization = extent[axis] > 0.0f ? max_extent / extent[axis] : 1.0f;
+		for (int split = 0; split < BUCKET_COUNT - 1; ++split)
+		{
+			Bucket below;
+			Bucket above;
+			for (int b = 0; b <= split; ++b)
+				below.add(buckets[b].min, buckets[b].max, buckets[b].bounds, buckets[b].count);
+			for (int b = split + 1; b < BUCKET_COUNT; ++b)
+				above.add(buckets[b].min, buckets[b].max, buckets[b].bounds, buckets[b].count);
+			if (below.count == 0 || above.count == 0)
+				continue;
+
+			float cost = regularization * (below.cost() + above.cost());
+			if (cost < best_cost)
+			{
+				best_cost  = cost;
+				best_axis  = axis;
+				best_split = split;
+			}
+		}
+	}
+
+	uint32_t middle;
+	if (best_axis >= 0)
+	{
+		auto it = std::partition(emitters.begin() + begin, emitters.begin() + end,
+		                         [&](const BuildEmitter &emitter) { return bucket_of(emitter, best_axis) <= best_split; });
+		middle  = static_cast<uint32_t>(it - emitters.begin());
+	}
+	else if (count <= UINT16_MAX)
+	{
+		// Coincident centroids, the leaf picks among them by power
+		return make_leaf();
+	}
+	else
+	{
+		middle = begin + count / 2;
+	}
+
+	build_recursive(emitters, begin, middle, depth + 1, nodes, node_bounds);
+	nodes[index].offset = build_recursive(emitters, middle, end, depth + 1, nodes, node_bounds);
+	nodes[index].count  = 0;
+	nodes[index].axis   = static_cast<uint8_t>(std::max(best_axis, 0));
+	return index;
+}
+}        // namespace
+
+LightBvh::LightBvh(std::vector<Emitter> emitters) :
+    LightSampler(std::move(emitters))
+{
+	Timer timer;
+
+	// Black emitters stay in the table for their light ids but are left out of the tree
+	std::vector<BuildEmitter> build_emitters;
+	build_emitters.reserve(emitters_.size());
+	for (uint32_t i = 0; i < emitters_.size(); ++i)
+	{
+		if (powers_[i] <= 0.0f)
+		{
+			continue;
+		}
+
+		const auto &emitter = emitters_[i];
+		glm::vec3   v1      = emitter.v0 + emitter.edge1;
+		glm::vec3   v2      = emitter.v0 + emitter.edge2;
+
+		BuildEmitter build;
+		build.min                = glm::min(emitter.v0, glm::min(v1, v2));
+		build.max                = glm::max(emitter.v0, glm::max(v1, v2));
+		build.centroid           = (emitter.v0 + v1 + v2) / 3.0f;
+		build.bounds.axis        = glm::cross(emitter.edge1, emitter.edge2) / (2.0f * areas_[i]);
+		build.bounds.cos_theta_o = 1.0f;
+		build.bounds.power       = powers_[i];
+		build.index              = i;
+		build_emitters.push_back(build);
+	}
+
+	if (build_emitters.empty())
+	{
+		return;
+	}
+
+	nodes_.reserve(2 * build_emitters.size());
+	bounds_.reserve(2 * build_emitters.size());
+	build_recursive(build_emitters, 0, static_cast<uint32_t>(build_emitters.size()), 0, nodes_, bounds_);
+
+	leaf_emitters_.reserve(build_emitters.size());
+	for (const auto &build : build_emitters)
+	{
+		leaf_emitters_.push_back(build.index);
+	}
+
+	trails_.resize(emitters_.size(), 0);
+	assign_trails(0, 0, 0);
+
+	build_time_ = timer.elapsed();
+}
+
+uint32_t LightBvh::pick(const glm::vec3 &origin, float u) const
+{
+	if (nodes_.empty())
+	{
+		return 0;
+	}
+
+	uint32_t index = 0;
+	while (!nodes_[index].is_leaf())
+	{
+		float p_first = first_child_probability(origin, index);
+		if (u < p_first)
+		{
+			u     = std::min(u / p_first, ONE_MINUS_EPSILON);
+			index = index + 1;
+		}
+		else
+		{
+			u     = std::min((u - p_first) / (1.0f - p_first), ONE_MINUS_EPSILON);
+			index = nodes_[index].offset;
+		}
+	}
+
+	// Leaves only hold several emitters when their centroids coincide, pick among them by power
+	const auto &leaf   = nodes_[index];
+	uint32_t    last   = leaf.offset + leaf.count - 1;
+	float       target = u * bounds_[index].power;
+	for (uint32_t i = leaf.offset; i < last; ++i)
+	{
+		auto light_id = leaf_emitters_[i];
+		if (target < powers_[light_id])
+		{
+			return light_id;
+		}
+		target -= powers_[light_id];
+	}
+	return leaf_emitters_[last];
+}
+
+float LightBvh::pmf(const glm::vec3 &origin, uint32_t light_id) const
+{
+	if (nodes_.empty() || powers_[light_id] <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	uint64_t trail = trails_[light_id];
+	uint32_t index = 0;
+	float    pmf   = 1.0f;
+	while (!nodes_[index].is_leaf())
+	{
+		float p_first = first_child_probability(origin, index);
+		if (trail & 1)
+		{
+			pmf *= 1.0f - p_first;
+			index = nodes_[index].offset;
+		}
+		else
+		{
+			pmf *= p_first;
+			index = index + 1;
+		}
+		trail >>= 1;
+	}
+	return pmf * powers_[light_id] / bounds_[index].power;
+}
+
+size_t LightBvh::node_count() const
+{
+	return nodes_.size();
+}
+
+float LightBvh::build_time() const
+{
+	return build_time_;
+}
+
+float LightBvh::importance(const glm::vec3 &p, uint32_t index) const
+{
+	const auto &node   = nodes_[index];
+	const auto &bounds = bounds_[index];
+
+	// Distance to the center, clamped to the bounding sphere so nearby clusters are not overweighted
+	glm::vec3 center            = 0.5f * (node.min + node.max);
+	glm::vec3 to_point          = p - center;
+	float     distance_squared  = glm::dot(to_point, to_point);
+	float     radius_squared    = 0.25f * glm::dot(node.max - node.min, node.max - node.min);
+	float     clamped_distance2 = std::max(distance_squared, radius_squared);
+
+	// Angle between the cone axis and the direction to p, either side of the emitters counts
+	float cos_theta_w = distance_squared > 0.0f ? std::fabs(glm::dot(bounds.axis, to_point)) / std::sqrt(distance_squared) : 1.0f;
+	float sin_theta_w = safe_sqrt(1.0f - cos_theta_w * cos_theta_w);
+
+	// Half angle of the cone of directions from p to the bounding sphere
+	float cos_theta_b = -1.0f;
+	if (distance_squared > radius_squared)
+	{
+		cos_theta_b = safe_sqrt(1.0f - radius_squared / distance_squared);
+	}
+	float sin_theta_b = safe_sqrt(1.0f - cos_theta_b * cos_theta_b);
+	float sin_theta_o = safe_sqrt(1.0f - bounds.cos_theta_o * bounds.cos_theta_o);
+
+	// theta' = max(0, theta_w - theta_o - theta_b), the emitters cannot face p beyond pi / 2
+	float cos_theta_x     = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, bounds.cos_theta_o);
+	float sin_theta_x     = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, bounds.cos_theta_o);
+	float cos_theta_prime = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+	if (cos_theta_prime <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	return bounds.power * cos_theta_prime / std::max(clamped_distance2, 1e-8f);
+}
+
+float LightBvh::first_child_probability(const glm::vec3 &p, uint32_t node) const
+{
+	uint32_t first  = node + 1;
+	uint32_t second = nodes_[node].offset;
+
+	float first_importance  = importance(p, first);
+	float second_importance = importance(p, second);
+	if (first_importance + second_importance <= 0.0f)
+	{
+		// Sampling and pmf() agree on the fallback, so the estimate stays unbiased
+		first_importance  = bounds_[first].power;
+		second_importance = bounds_[second].power;
+	}
+	return first_importance / (first_importance + second_importance);
+}
+
+void LightBvh::assign_trails(uint32_t node, uint64_t trail, int depth)
+{
+	const auto &n = nodes_[node];
+	if (n.is_leaf())
+	{
+		for (uint32_t i = n.offset; i < n.offset + n.count; ++i)
+		{
+			trails_[leaf_emitters_[i]] = trail;
+		}
+		return;
+	}
+	assign_trails(node + 1, trail, depth + 1);
+	assign_trails(n.offset, trail | (uint64_t{1} << depth), depth + 1);
+}
+}        // namespace mengze::rt
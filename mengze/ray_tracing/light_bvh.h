@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/bvh_builder.h"
+#include "ray_tracing/light_sampler.h"
+
+namespace mengze::rt
+{
+// Power and orientation of everything below a light BVH node, the spatial bounds live in the BvhNode
+struct LightBounds
+{
+	glm::vec3 axis{0.0f, 0.0f, 1.0f};        // normal cone, emitters are two-sided so -axis is covered as well
+	float     cos_theta_o{1.0f};
+	float     power{0.0f};
+};
+
+/**
+ * @brief Light BVH over the emissive triangles of a scene (Conty Estevez and Kulla 2018).
+ *
+ * Clusters are split by a surface area orientation heuristic that weighs power, spatial bounds and the
+ * cone of normals. A light is picked by descending the tree and choosing each child with a probability
+ * proportional to its importance for the shading point, so the pmf of a given triangle is recomputed
+ * in O(log n) by following the bit trail of its leaf.
+ */
+class LightBvh final : public LightSampler
+{
+  public:
+	explicit LightBvh(std::vector<Emitter> emitters);
+
+	uint32_t pick(const glm::vec3 &origin, float u) const override;
+
+	float pmf(const glm::vec3 &origin, uint32_t light_id) const override;
+
+	size_t node_count() const;
+
+	// Build time in milliseconds
+	float build_time() const;
+
+  private:
+	float importance(const glm::vec3 &p, uint32_t node) const;
+
+	// Probability of descending into the first child, falls back to power when neither child faces p
+	float first_child_probability(const glm::vec3 &p, uint32_t node) const;
+
+	void assign_trails(uint32_t node, uint64_t trail, int depth);
+
+  private:
+	std::vector<uint32_t> leaf_emitters_;        // light ids in leaf order
+	std::vector<uint64_t> trails_;               // per light id, bit i selects the child at depth i
+
+	std::vector<BvhNode>     nodes_;
+	std::vector<LightBounds> bounds_;
+
+	float build_time_{0.0f};
+};
+}        // namespace mengze::rt
@@ -0,0 +1,309 @@
+#include "ray_tracing/light_sampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ray_tracing/math.h"
+
+namespace mengze::rt
+{
+const char *to_string(LightSamplerType type)
+{
+	switch (type)
+	{
+		case LightSamplerType::kPower:
+			return "power";
+		case LightSamplerType::kLightBvh:
+			return "light BVH";
+	}
+	return "unknown";
+}
+
+LightSampler::LightSampler(std::vector<Emitter> emitters) :
+    emitters_(std::move(emitters))
+{
+	areas_.reserve(emitters_.size());
+	powers_.reserve(emitters_.size());
+	for (const auto &emitter : emitters_)
+	{
+		float area  = 0.5f * glm::length(glm::cross(emitter.edge1, emitter.edge2));
+		float power = std::max(rgb_to_luminance(emitter.radiance), 0.0f) * area;
+		areas_.push_back(area);
+		powers_.push_back(power);
+		total_power_ += power;
+	}
+}
+
+bool LightSampler::sample(const glm::vec3 &origin, Sampler &sampler, LightSample &light_sample) const
+{
+	if (empty())
+		return false;
+
+	// The environment takes the bottom of the same number, the rest is stretched back over [0, 1) for the emitters
+	float u_light = sampler.get_1d();
+	if (u_light < environment_probability_)
+	{
+		glm::vec3 direction;
+		float     pdf;
+		if (!environment_->sample(sampler.get_2d(), direction, pdf))
+			return false;
+
+		light_sample.position = origin + direction * environment_distance_;
+		light_sample.normal   = -direction;
+		light_sample.radiance = environment_->radiance(direction);
+		light_sample.pdf      = environment_probability_ * pdf;
+		light_sample.light_id = ENVIRONMENT_LIGHT_ID;
+		return true;
+	}
+	u_light = std::min((u_light - environment_probability_) / (1.0f - environment_probability_), 0.99999994f);
+
+	uint32_t light_id = pick(origin, u_light);
+	float    pmf      = this->pmf(origin, light_id) * (1.0f - environment_probability_);
+	if (pmf <= 0.0f)
+		return false;
+
+	const auto &emitter = emitters_[light_id];
+	glm::vec3   normal  = glm::cross(emitter.edge1, emitter.edge2) / (2.0f * areas_[light_id]);
+	glm::vec2   u       = sampler.get_2d();
+
+	// The point is where the sampled direction meets the emitter's plane, no ray has to be traced
+	float solid_angle = sampled_solid_angle(origin, light_id);
+	if (solid_angle > 0.0f)
+	{
+		glm::vec3 direction = sample_spherical_triangle(origin, emitter.v0, emitter.v0 + emitter.edge1, emitter.v0 + emitter.edge2, u);
+		float     cosine    = glm::dot(normal, direction);
+		if (std::fabs(cosine) < 1e-6f)
+			return false;
+
+		light_sample.position = origin + direction * (glm::dot(emitter.v0 - origin, normal) / cosine);
+		light_sample.pdf      = pmf / solid_angle;
+	}
+	else
+	{
+		float r1 = u.x;
+		float r2 = u.y;
+
+		if (r1 + r2 >= 1.0f)
+		{
+			r1 = 1.0f - r1;
+			r2 = 1.0f - r2;
+		}
+
+		glm::vec3 position         = emitter.v0 + r1 * emitter.edge1 + r2 * emitter.edge2;
+		glm::vec3 direction        = position - origin;
+		float     distance_squared = glm::dot(direction, direction);
+		float     cosine           = std::fabs(glm::dot(normal, direction)) / std::sqrt(distance_squared);
+		if (cosine < 1e-6f)
+			return false;
+
+		light_sample.position = position;
+		light_sample.pdf      = pmf * distance_squared / (cosine * areas_[light_id]);
+	}
+
+	light_sample.normal   = normal;
+	light_sample.radiance = emitter.radiance;
+	light_sample.light_id = light_id;
+	return std::isfinite(light_sample.position.x + light_sample.position.y + light_sample.position.z);
+}
+
+void LightSampler::set_solid_angle_sampling(bool enabled)
+{
+	solid_angle_sampling_ = enabled;
+}
+
+void LightSampler::set_environment(const EnvironmentLight *environment, const glm::vec3 &scene_center, float scene_radius)
+{
+	environment_             = environment;
+	environment_probability_ = 0.0f;
+	environment_distance_    = 4.0f * scene_radius;
+	scene_center_            = scene_center;
+	scene_radius_            = scene_radius;
+	if (!environment_)
+		return;
+
+	// Power is luminance times area for the emitters, the environment's falls on the disk the scene's sphere casts
+	float environment_power  = scene_radius * scene_radius * environment_->total_luminance();
+	environment_probability_ = environment_power > 0.0f ? environment_power / (environment_power + total_power_) : 0.0f;
+}
+
+const EnvironmentLight *LightSampler::environment() const
+{
+	return environment_;
+}
+
+float LightSampler::environment_probability() const
+{
+	return environment_probability_;
+}
+
+float LightSampler::sampled_solid_angle(const glm::vec3 &origin, uint32_t light_id) const
+{
+	if (!solid_angle_sampling_)
+		return 0.0f;
+
+	const auto &emitter     = emitters_[light_id];
+	float       solid_angle = spherical_triangle_area(origin, emitter.v0, emitter.v0 + emitter.edge1, emitter.v0 + emitter.edge2);
+	return solid_angle >= MIN_SPHERICAL_SAMPLING_AREA && solid_angle <= MAX_SPHERICAL_SAMPLING_AREA ? solid_angle : 0.0f;
+}
+
+bool LightSampler::sample_emission(Sampler &sampler, EmissionSample &emission) const
+{
+	if (total_power_ <= 0.0f)
+		return false;
+
+	glm::vec3 origin{0.0f};
+	uint32_t  light_id = pick(origin, sampler.get_1d());
+	float     pmf      = this->pmf(origin, light_id);
+	if (pmf <= 0.0f)
+		return false;
+
+	const auto &emitter = emitters_[light_id];
+
+	glm::vec2 u  = sampler.get_2d();
+	float     r1 = u.x;
+	float     r2 = u.y;
+
+	if (r1 + r2 >= 1.0f)
+	{
+		r1 = 1.0f - r1;
+		r2 = 1.0f - r2;
+	}
+
+	// Emitters are two-sided, so half of the directions leave through the back
+	glm::vec3 normal = glm::cross(emitter.edge1, emitter.edge2) / (2.0f * areas_[light_id]);
+	if (sampler.get_1d() < 0.5f)
+		normal = -normal;
+
+	OrthoNormalBasis uvw;
+	uvw.build_from_w(normal);
+	glm::vec3 direction = glm::normalize(uvw.to_local(random_cosine_direction(sampler.get_2d())));
+
+	emission.ray      = Ray(emitter.v0 + r1 * emitter.edge1 + r2 * emitter.edge2, direction);
+	emission.normal   = normal;
+	emission.radiance = emitter.radiance;
+	emission.light_id = light_id;
+	emission_pdf(light_id, normal, direction, emission.pdf_position, emission.pdf_direction);
+	return emission.pdf_direction > 0.0f;
+}
+
+bool LightSampler::sample_environment_emission(Sampler &sampler, EmissionSample &emission) const
+{
+	if (environment_probability_ <= 0.0f)
+		return false;
+
+	glm::vec3 direction;
+	float     pdf;
+	if (!environment_->sample(sampler.get_2d(), direction, pdf))
+		return false;
+
+	// The disk faces the direction the light comes from and lies one radius out, so it covers the whole scene
+	OrthoNormalBasis uvw;
+	uvw.build_from_w(direction);
+	glm::vec2 u      = sampler.get_2d();
+	float     radius = scene_radius_ * std::sqrt(u.x);
+	float     phi    = 2.0f * glm::pi<float>() * u.y;
+	glm::vec3 origin = scene_center_ + scene_radius_ * direction + uvw.to_local({radius * std::cos(phi), radius * std::sin(phi), 0.0f});
+
+	emission.ray           = Ray(origin, -direction);
+	emission.normal        = -direction;
+	emission.radiance      = environment_->radiance(direction);
+	emission.pdf_position  = 1.0f / (glm::pi<float>() * scene_radius_ * scene_radius_);
+	emission.pdf_direction = pdf;
+	emission.light_id      = ENVIRONMENT_LIGHT_ID;
+	return true;
+}
+
+void LightSampler::emission_pdf(uint32_t light_id, const glm::vec3 &normal, const glm::vec3 &direction, float &pdf_position, float &pdf_direction) const
+{
+	pdf_position  = pmf(glm::vec3{0.0f}, light_id) / areas_[light_id];
+	pdf_direction = std::fabs(glm::dot(normal, direction)) / (glm::length(direction) * 2.0f * glm::pi<float>());
+}
+
+float LightSampler::pdf_value(const glm::vec3 &origin, const HitRecord &rec) const
+{
+	if (rec.light_id >= emitters_.size())
+		return 0.0f;
+
+	float pick_probability = pmf(origin, rec.light_id) * (1.0f - environment_probability_);
+	float solid_angle      = sampled_solid_angle(origin, rec.light_id);
+	if (solid_angle > 0.0f)
+		return pick_probability / solid_angle;
+
+	glm::vec3 direction        = rec.position - origin;
+	float     distance_squared = glm::dot(direction, direction);
+	float     cosine           = std::fabs(glm::dot(rec.normal, direction)) / std::sqrt(distance_squared);
+	if (cosine < 1e-6f)
+		return 0.0f;
+
+	return pick_probability * distance_squared / (cosine * areas_[rec.light_id]);
+}
+
+float LightSampler::environment_pdf(const glm::vec3 &direction) const
+{
+	if (environment_probability_ <= 0.0f)
+		return 0.0f;
+
+	return environment_probability_ * environment_->pdf(direction);
+}
+
+bool LightSampler::empty() const
+{
+	return total_power_ <= 0.0f && environment_probability_ <= 0.0f;
+}
+
+size_t LightSampler::emitter_count() const
+{
+	return emitters_.size();
+}
+
+PowerLightSampler::PowerLightSampler(std::vector<Emitter> emitters) :
+    LightSampler(std::move(emitters))
+{
+	if (total_power_ <= 0.0f)
+	{
+		return;
+	}
+
+	// Vose's method, every bin keeps its own emitter below the threshold and the alias above
+	auto                  n = static_cast<uint32_t>(powers_.size());
+	std::vector<float>    scaled(n);
+	std::vector<uint32_t> small;
+	std::vector<uint32_t> large;
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		scaled[i] = powers_[i] / total_power_ * n;
+		(scaled[i] < 1.0f ? small : large).push_back(i);
+	}
+
+	bins_.resize(n);
+	while (!small.empty() && !large.empty())
+	{
+		uint32_t s = small.back();
+		uint32_t l = large.back();
+		small.pop_back();
+		large.pop_back();
+
+		bins_[s] = {scaled[s], l};
+		scaled[l] -= 1.0f - scaled[s];
+		(scaled[l] < 1.0f ? small : large).push_back(l);
+	}
+	// Whatever is left is 1 up to rounding
+	for (auto i : large)
+		bins_[i] = {1.0f, i};
+	for (auto i : small)
+		bins_[i] = {1.0f, i};
+}
+
+uint32_t PowerLightSampler::pick(const glm::vec3 &origin, float u) const
+{
+	auto  n      = static_cast<uint32_t>(bins_.size());
+	float scaled = u * n;
+	auto  bin    = std::min(static_cast<uint32_t>(scaled), n - 1);
+	return scaled - bin < bins_[bin].threshold ? bin : bins_[bin].alias;
+}
+
+float PowerLightSampler::pmf(const glm::vec3 &origin, uint32_t light_id) const
+{
+	return total_power_ > 0.0f ? powers_[light_id] / total_power_ : 0.0f;
+}
+}        // namespace mengze::rt
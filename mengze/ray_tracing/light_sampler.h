@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/environment_light.h"
+#include "ray_tracing/hittable.h"
+#include "ray_tracing/sampler.h"
+
+namespace mengze::rt
+{
+constexpr uint32_t ENVIRONMENT_LIGHT_ID = INVALID_LIGHT_ID - 1;        // light_id of samples on the environment
+
+enum class LightSamplerType
+{
+	kPower,           // alias table over emitter power, independent of the shading point
+	kLightBvh,        // importance of light clusters for the shading point
+};
+
+const char *to_string(LightSamplerType type);
+
+struct LightSample
+{
+	glm::vec3 position;        // far outside the scene for the environment
+	glm::vec3 normal;
+	glm::vec3 radiance;
+	float     pdf;        // solid angle density at the shading point
+	uint32_t  light_id;
+};
+
+struct EmissionSample
+{
+	Ray       ray;                  // leaves the emitter, direction normalized
+	glm::vec3 normal;               // on the side the ray leaves through
+	glm::vec3 radiance;
+	float     pdf_position;         // area density of the point, times the pmf of its emitter
+	float     pdf_direction;        // solid angle density of the direction
+	uint32_t  light_id;
+};
+
+/**
+ * @brief Picks emissive triangles and the environment for next event estimation.
+ *
+ * Holds the scene's emitter table, indexed by the light_id that hits on emitters report, so the light
+ * pdf of a BSDF-sampled ray is evaluated from its hit record without intersecting any light again.
+ * Subclasses only decide how an emitter is picked. The environment is chosen first, with a fixed
+ * probability, and starts light paths only through sample_environment_emission().
+ */
+class LightSampler
+{
+  public:
+	explicit LightSampler(std::vector<Emitter> emitters);
+
+	virtual ~LightSampler() = default;
+
+	// Picks an emitter for a shading point at origin, u is uniform in [0, 1)
+	virtual uint32_t pick(const glm::vec3 &origin, float u) const = 0;
+
+	// Probability of pick() returning the emitter, 0 for emitters that are never picked
+	virtual float pmf(const glm::vec3 &origin, uint32_t light_id) const = 0;
+
+	// Picks an emitter and a point on it, fails when nothing can be picked or the point is seen edge-on
+	bool sample(const glm::vec3 &origin, Sampler &sampler, LightSample &light_sample) const;
+
+	/**
+	 * @brief Samples points on the picked emitter uniformly in the solid angle it subtends instead of by
+	 * area, which removes the distance and cosine terms from the estimate of large nearby emitters.
+	 * Emitters that subtend too small a solid angle for it to be accurate are still sampled by area.
+	 */
+	void set_solid_angle_sampling(bool enabled);
+
+	/**
+	 * @brief Samples the environment besides the emitters, in proportion to the power it sends into the
+	 * scene's bounding sphere against theirs. Null removes it.
+	 */
+	void set_environment(const EnvironmentLight *environment, const glm::vec3 &scene_center, float scene_radius);
+
+	// Null without environment
+	const EnvironmentLight *environment() const;
+
+	// Probability of sample() picking the environment, also the share of light paths that should start on it
+	float environment_probability() const;
+
+	/**
+	 * @brief Starts a light path: picks an emitter, a point on it and a cosine distributed direction on
+	 * either side. Emitters are picked as seen from the origin, which only makes sense for samplers that
+	 * ignore the shading point.
+	 */
+	bool sample_emission(Sampler &sampler, EmissionSample &emission) const;
+
+	/**
+	 * @brief Starts a light path on the environment: a direction from its distribution, entering the scene
+	 * through a uniform point of the disk the bounding sphere casts. pdf_position is per area of the disk
+	 * and neither density includes environment_probability().
+	 */
+	bool sample_environment_emission(Sampler &sampler, EmissionSample &emission) const;
+
+	// Densities of sample_emission() starting at a point of the emitter and leaving in the direction
+	void emission_pdf(uint32_t light_id, const glm::vec3 &normal, const glm::vec3 &direction, float &pdf_position, float &pdf_direction) const;
+
+	// Solid angle density of sample() producing the hit of a ray from origin, 0 when it is no emitter
+	float pdf_value(const glm::vec3 &origin, const HitRecord &rec) const;
+
+	// Solid angle density of sample() producing a ray that escapes in the direction, 0 without environment
+	float environment_pdf(const glm::vec3 &direction) const;
+
+	bool empty() const;
+
+	size_t emitter_count() const;
+
+  protected:
+	// Solid angle the emitter subtends at origin when it is sampled by solid angle, 0 when it is sampled by area
+	float sampled_solid_angle(const glm::vec3 &origin, uint32_t light_id) const;
+
+	std::vector<Emitter> emitters_;
+	std::vector<float>   areas_;
+	std::vector<float>   powers_;        // luminance times area, 0 for black emitters
+	float                total_power_{0.0f};
+	bool                 solid_angle_sampling_{false};
+
+	const EnvironmentLight *environment_{nullptr};
+	float                   environment_probability_{0.0f};
+	float                   environment_distance_{0.0f};        // of sampled points from the shading point
+	glm::vec3               scene_center_{0.0f};
+	float                   scene_radius_{0.0f};
+};
+
+/**
+ * @brief Power-proportional selection with a Walker alias table, O(1) to sample and to evaluate.
+ */
+class PowerLightSampler final : public LightSampler
+{
+  public:
+	explicit PowerLightSampler(std::vector<Emitter> emitters);
+
+	uint32_t pick(const glm::vec3 &origin, float u) const override;
+
+	float pmf(const glm::vec3 &origin, uint32_t light_id) const override;
+
+  private:
+	struct AliasBin
+	{
+		float    threshold;
+		uint32_t alias;
+	};
+
+	std::vector<AliasBin> bins_;
+};
+}        // namespace mengze::rt
@@ -13,11 +13,11 @@ float rgb_to_luminance(glm::vec3 rgb)
 	return 0.2126f * rgb.r + 0.7152f * rgb.g + 0.0722 * rgb.b;
 }
 
-bool Lambertian::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const
+bool Lambertian::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const
 {
 	scatter_record.attenuation = albedo_->value(hit_record.u, hit_record.v, hit_record.position);
 	scatter_record.skip_pdf    = false;
-	scatter_record.pdf         = std::make_shared<CosinePdf>(hit_record.normal);
+	scatter_record.pdf         = CosinePdf(hit_record.normal);
 
 	return true;
 }
@@ -43,24 +43,26 @@ float Metal::shininess_to_fuzz(float shininess)
 	return fuzz;
 }
 
-bool Metal::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const
+bool Metal::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const
 {
 	scatter_record.attenuation  = albedo_;
 	scatter_record.skip_pdf     = true;
-	scatter_record.pdf          = nullptr;
+	scatter_record.pdf          = {};
 	glm::vec3 reflected         = glm::reflect(glm::normalize(ray_in.direction()), hit_record.normal);
-	scatter_record.skip_pdf_ray = Ray(hit_record.position, reflected + fuzz_ * random_in_unit_sphere());
+	glm::vec2 u_direction       = sampler.get_2d();
+	float     u_radius          = sampler.get_1d();
+	scatter_record.skip_pdf_ray = Ray(hit_record.position, reflected + fuzz_ * random_in_unit_sphere(u_direction, u_radius));
 
 	return true;
 }
 
-bool PhongMaterial::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const
+bool PhongMaterial::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const
 {
 	scatter_record.attenuation = specular_texture_->value(hit_record.u, hit_record.v, hit_record.position);
 	scatter_record.skip_pdf    = false;
 	float ks                   = rgb_to_luminance(specular_texture_->value(hit_record.u, hit_record.v, hit_record.position));
 	float kd                   = rgb_to_luminance(diffuse_texture_->value(hit_record.u, hit_record.v, hit_record.position));
-	scatter_record.pdf         = std::make_shared<PhongPdf>(hit_record.normal, glm::reflect(glm::normalize(ray_in.direction()), hit_record.normal), shininess_, kd, ks);
+	scatter_record.pdf         = PhongPdf(hit_record.normal, glm::reflect(glm::normalize(ray_in.direction()), hit_record.normal), shininess_, kd, ks);
 
 	return true;
 }
@@ -111,12 +113,12 @@ Dielectric::Dielectric(float refraction_index):
 	refraction_index_(refraction_index)
 {}
 
-bool Dielectric::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const
+bool Dielectric::scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const
 {
 	scatter_record.attenuation = glm::vec3(1.0, 1.0, 1.0);
 	float refraction_ratio     = hit_record.front_face ? (1.0f / refraction_index_) : refraction_index_;
 	scatter_record.skip_pdf    = true;
-	scatter_record.pdf         = nullptr;
+	scatter_record.pdf         = {};
 
 	glm::vec3 unit_direction = glm::normalize(ray_in.direction());
 	float     cos_theta      = std::min(glm::dot(-unit_direction, hit_record.normal), 1.0f);
@@ -125,7 +127,7 @@ bool Dielectric::scatter(const Ray &ray_in, const HitRecord &hit_record, Scatter
 	bool      cannot_refract = refraction_ratio * sin_theta > 1.0f;
 	glm::vec3 direction;
 
-	if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_float(0, 1))
+	if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sampler.get_1d())
 	{
 		direction = glm::reflect(unit_direction, hit_record.normal);
 	}
@@ -13,13 +13,15 @@ namespace mengze::rt
 
 class HitRecord;
 
+float rgb_to_luminance(glm::vec3 rgb);
+
 struct ScatterRecord
 {
 	Ray       skip_pdf_ray;
 	bool      skip_pdf;
 	glm::vec3 attenuation;
 
-	std::shared_ptr<Pdf> pdf;
+	ScatterPdf pdf;        // held by value, scattering allocates nothing
 };
 
 class Material
@@ -27,7 +29,7 @@ class Material
   public:
 	virtual ~Material() = default;
 
-	virtual bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const = 0;
+	virtual bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const = 0;
 
 	virtual float scattering_pdf(const Ray &ray_in, const HitRecord &hit_record, const Ray &scattered) const
 	{
@@ -48,6 +50,12 @@ class Material
 	{
 		return false;
 	}
+
+	// True when the reflected radiance does not depend on the view direction, so it can be cached per surface point
+	virtual bool is_diffuse() const
+	{
+		return false;
+	}
 };
 
 class Lambertian : public Material
@@ -61,12 +69,17 @@ class Lambertian : public Material
 	    albedo_(std::make_shared<SolidColor>(albedo))
 	{}
 
-	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const override;
+	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const override;
 
 	glm::vec3 debug_color(float u, float v, const glm::vec3 &p) const override;
 
 	float scattering_pdf(const Ray &ray_in, const HitRecord &hit_record, const Ray &scattered) const override;
 
+	bool is_diffuse() const override
+	{
+		return true;
+	}
+
   private:
 	std::shared_ptr<Texture> albedo_;
 };
@@ -81,7 +94,7 @@ class Metal : public Material
 
 	static float shininess_to_fuzz(float shininess);
 
-	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const override;
+	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const override;
 
   private:
 	glm::vec3 albedo_;
@@ -103,7 +116,7 @@ class PhongMaterial : public Material
 	    shininess_(ns)
 	{}
 
-	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const override;
+	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const override;
 
 	float scattering_pdf(const Ray &ray_in, const HitRecord &hit_record, const Ray &scattered) const override;
 
@@ -124,7 +137,7 @@ class Dielectric : public Material
   public:
 	Dielectric(float refraction_index);
 
-	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const override;
+	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const override;
 
   private:
 	float refraction_index_;
@@ -148,7 +161,7 @@ class DiffuseLight : public Material
 	    emit_(std::make_shared<SolidColor>(color))
 	{}
 
-	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record) const override
+	bool scatter(const Ray &ray_in, const HitRecord &hit_record, ScatterRecord &scatter_record, Sampler &sampler) const override
 	{
 		return false;
 	}
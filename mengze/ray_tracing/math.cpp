@@ -56,4 +56,50 @@ float Interval::clamp(float x) const
 {
 	return std::max(min_, std::min(x, max_));
 }
+
+float spherical_triangle_area(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	glm::vec3 da = glm::normalize(a - p);
+	glm::vec3 db = glm::normalize(b - p);
+	glm::vec3 dc = glm::normalize(c - p);
+
+	float numerator   = std::fabs(glm::dot(da, glm::cross(db, dc)));
+	float denominator = 1.0f + glm::dot(da, db) + glm::dot(db, dc) + glm::dot(dc, da);
+	return 2.0f * std::atan2(numerator, denominator);
+}
+
+glm::vec3 sample_spherical_triangle(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, const glm::vec2 &u)
+{
+	glm::vec3 da = glm::normalize(a - p);
+	glm::vec3 db = glm::normalize(b - p);
+	glm::vec3 dc = glm::normalize(c - p);
+
+	// Normals of the great circles through the edges, the angles between them are the triangle's inner angles
+	glm::vec3 n_ab = glm::normalize(glm::cross(da, db));
+	glm::vec3 n_bc = glm::normalize(glm::cross(db, dc));
+	glm::vec3 n_ca = glm::normalize(glm::cross(dc, da));
+
+	auto  angle = [](const glm::vec3 &x, const glm::vec3 &y) { return std::acos(std::clamp(glm::dot(x, y), -1.0f, 1.0f)); };
+	float alpha = angle(n_ab, -n_ca);
+	float beta  = angle(n_bc, -n_ab);
+	float gamma = angle(n_ca, -n_bc);
+
+	// Picks the sub-triangle a, b, c' of area u.x times the whole, c' lies on the arc from a to c. The
+	// formulas take the sub-triangle's area plus pi, the sum of its angles
+	float angle_sum = glm::pi<float>() + u.x * (alpha + beta + gamma - glm::pi<float>());
+	float sin_phi   = std::sin(angle_sum) * std::cos(alpha) - std::cos(angle_sum) * std::sin(alpha);
+	float cos_phi   = std::cos(angle_sum) * std::cos(alpha) + std::sin(angle_sum) * std::sin(alpha);
+	float k1        = cos_phi + std::cos(alpha);
+	float k2        = sin_phi - std::sin(alpha) * glm::dot(da, db);
+	float cos_b     = (k2 + (k2 * cos_phi - k1 * sin_phi) * std::cos(alpha)) / ((k2 * sin_phi + k1 * cos_phi) * std::sin(alpha));
+	cos_b           = std::clamp(cos_b, -1.0f, 1.0f);
+	float sin_b     = std::sqrt(std::max(1.0f - cos_b * cos_b, 0.0f));
+
+	glm::vec3 c_prime = cos_b * da + sin_b * glm::normalize(dc - glm::dot(dc, da) * da);
+
+	// Uniform on the arc from b to c' after the cosine warp that makes the density uniform in solid angle
+	float cos_theta = 1.0f - u.y * (1.0f - glm::dot(c_prime, db));
+	float sin_theta = std::sqrt(std::max(1.0f - cos_theta * cos_theta, 0.0f));
+	return glm::normalize(cos_theta * db + sin_theta * glm::normalize(c_prime - glm::dot(c_prime, db) * db));
+}
 }        // namespace mengze::rt
@@ -2,11 +2,13 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
-#include <random>
+#include <atomic>
 
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/glm.hpp>
 
+#include "ray_tracing/rng.h"
+
 #ifndef M_PI
 #	define M_PI 3.14159265358979323846
 #endif
@@ -101,42 +103,50 @@ class OrthoNormalBasis
 };
 
 
-inline float random_float(const float min = 0.0f, const float max = 1.0f)
+// Generator of the calling thread, for code outside the render loop such as scene setup
+inline Rng &thread_rng()
 {
-	static std::random_device             rd;
-	std::uniform_real_distribution<float> distribution(min, max);
-	static std::mt19937                   generator(rd());
-	return distribution(generator);
+	static std::atomic<uint64_t> thread_counter{0};
+	thread_local Rng             rng(Rng::mix(thread_counter++));
+	return rng;
 }
 
-inline glm::vec3 random_unit_vector()
+inline float random_float(Rng &rng, const float min = 0.0f, const float max = 1.0f)
 {
-	auto a = random_float(0, glm::pi<float>());        // Random azimuthal angle
-	auto z = random_float(-1, 1);                      // Random cosine of the zenith angle
-	auto r = sqrt(1 - z * z);                          // Radius in the xy-plane
+	return rng.next_float(min, max);
+}
 
-	return {r * cos(a), r * sin(a), z};
+inline float random_float(const float min = 0.0f, const float max = 1.0f)
+{
+	return random_float(thread_rng(), min, max);
 }
 
 inline glm::vec3 random_vec3(const float min = 0.0f, const float max = 1.0f)
 {
-	return {random_float(min, max), random_float(min, max), random_float(min, max)};
+	auto &rng = thread_rng();
+	return {random_float(rng, min, max), random_float(rng, min, max), random_float(rng, min, max)};
 }
 
-inline glm::vec3 random_in_unit_sphere()
+// The warps below map uniform samples in [0, 1) from a Sampler, every sample is used exactly once
+inline glm::vec3 random_unit_vector(const glm::vec2 &u)
 {
-	while (true)
-	{
-		auto p = random_vec3(-1, 1);
-		if (glm::dot(p, p) < 1)
-			return p;
-	}
+	auto a = 2.0f * glm::pi<float>() * u.x;        // Random azimuthal angle
+	auto z = 1.0f - 2.0f * u.y;                    // Random cosine of the zenith angle
+	auto r = sqrt(std::max(0.0f, 1 - z * z));      // Radius in the xy-plane
+
+	return {r * cos(a), r * sin(a), z};
 }
 
-inline glm::vec3 random_cosine_direction()
+// Uniform in the unit ball without rejection, the radius follows the cube root of u_radius
+inline glm::vec3 random_in_unit_sphere(const glm::vec2 &u_direction, float u_radius)
 {
-	float r1 = random_float();
-	float r2 = random_float();
+	return std::cbrt(u_radius) * random_unit_vector(u_direction);
+}
+
+inline glm::vec3 random_cosine_direction(const glm::vec2 &u)
+{
+	float r1 = u.x;
+	float r2 = u.y;
 	float z  = sqrt(1 - r2);
 
 	float phi = 2 * glm::pi<float>() * r1;
@@ -146,8 +156,46 @@ inline glm::vec3 random_cosine_direction()
 	return {x, y, z};
 }
 
+// Solid angles sample_spherical_triangle() is accurate for, smaller ones lose precision and larger ones degenerate
+constexpr float MIN_SPHERICAL_SAMPLING_AREA = 3e-4f;
+constexpr float MAX_SPHERICAL_SAMPLING_AREA = 6.22f;
+
+// Solid angle the triangle a, b, c subtends at p (Van Oosterom and Strackee 1983)
+float spherical_triangle_area(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+
+/**
+ * @brief Direction from p uniformly distributed over the solid angle of the triangle a, b, c (Arvo 1995),
+ * normalized. Callers sample triangles outside the accurate range of solid angles by area.
+ */
+glm::vec3 sample_spherical_triangle(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, const glm::vec2 &u);
+
 inline bool near_zero(const glm::vec3 &v, float epsilon = 1e-8f)
 {
 	return glm::abs(v.x) < epsilon && glm::abs(v.y) < epsilon && glm::abs(v.z) < epsilon;
 }
+
+// Multiple importance sampling weight of one sample from each of two strategies
+inline float power_heuristic(float pdf, float other_pdf)
+{
+	float pdf_squared = pdf * pdf;
+	float sum         = pdf_squared + other_pdf * other_pdf;
+	return sum > 0.0f ? pdf_squared / sum : 0.0f;
+}
+
+// Lock-free addition for the statistics that render threads accumulate
+inline void atomic_add(std::atomic<float> &target, float value)
+{
+	float current = target.load(std::memory_order_relaxed);
+	while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+// One of 6 classes by the dominant axis of the normal and its sign, 2 * axis + 1 for negative normals
+inline int normal_class(const glm::vec3 &n)
+{
+	glm::vec3 magnitude = glm::abs(n);
+	int       axis      = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+	return 2 * axis + (n[axis] < 0.0f ? 1 : 0);
+}
 }        // namespace mengze::rt
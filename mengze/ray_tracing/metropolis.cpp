@@ -0,0 +1,89 @@
+#include "ray_tracing/metropolis.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ray_tracing/math.h"
+
+namespace mengze::rt
+{
+PrimarySampleSpace::PrimarySampleSpace(uint64_t seed, uint64_t sequence, float sigma, float large_step_probability) :
+    rng_(seed, sequence), sigma_(sigma), large_step_probability_(large_step_probability)
+{
+}
+
+void PrimarySampleSpace::start_iteration()
+{
+	++iteration_;
+	large_step_ = rng_.next_float() < large_step_probability_;
+	index_      = 0;
+}
+
+float PrimarySampleSpace::next()
+{
+	size_t index = index_++;
+	ensure_ready(index);
+	return components_[index].value;
+}
+
+void PrimarySampleSpace::accept()
+{
+	if (large_step_)
+	{
+		last_large_step_ = iteration_;
+	}
+}
+
+void PrimarySampleSpace::reject()
+{
+	for (auto &component : components_)
+	{
+		if (component.modified == iteration_)
+		{
+			component.value    = component.backup;
+			component.modified = component.backup_modified;
+		}
+	}
+	--iteration_;
+}
+
+void PrimarySampleSpace::reseed(uint64_t seed, uint64_t sequence)
+{
+	rng_ = Rng(seed, sequence);
+}
+
+void PrimarySampleSpace::ensure_ready(size_t index)
+{
+	if (index >= components_.size())
+	{
+		components_.resize(index + 1);
+	}
+	auto &component = components_[index];
+
+	// A component the last accepted large step did not reach starts from a uniform number of its own
+	if (component.modified < last_large_step_)
+	{
+		component.value    = rng_.next_float();
+		component.modified = last_large_step_;
+	}
+
+	component.backup          = component.value;
+	component.backup_modified = component.modified;
+	if (large_step_)
+	{
+		component.value = rng_.next_float();
+	}
+	else
+	{
+		// The small steps the component missed add up to one normal step with a larger deviation
+		auto  small_steps = static_cast<float>(iteration_ - component.modified);
+		float u1          = rng_.next_float();
+		float u2          = rng_.next_float();
+		float normal      = std::sqrt(-2.0f * std::log(1.0f - u1)) * std::cos(2.0f * glm::pi<float>() * u2);
+		component.value += normal * sigma_ * std::sqrt(small_steps);
+		component.value -= std::floor(component.value);
+		component.value  = std::min(component.value, 0x1.fffffep-1f);
+	}
+	component.modified = iteration_;
+}
+}        // namespace mengze::rt
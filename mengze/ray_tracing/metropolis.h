@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/rng.h"
+
+namespace mengze::rt
+{
+/**
+ * @brief Primary sample vector of a Metropolis chain (Kelemen et al. 2002).
+ *
+ * A path is a deterministic function of the uniform numbers its sampler hands out, so mutating those
+ * numbers mutates the path without knowing anything about how it was built. Components are created and
+ * mutated lazily when next() reaches them: a large step replaces them with fresh uniform numbers, a small
+ * step perturbs them by a wrapped normal, applied as many times as the component missed. reject() brings
+ * back the components the last iteration changed.
+ */
+class PrimarySampleSpace
+{
+  public:
+	PrimarySampleSpace() = default;
+
+	PrimarySampleSpace(uint64_t seed, uint64_t sequence, float sigma, float large_step_probability);
+
+	// Starts the next mutation, components restart at 0
+	void start_iteration();
+
+	// Next component of the mutated vector
+	float next();
+
+	void accept();
+
+	void reject();
+
+	// Restarts the random numbers of the mutations, the current vector is kept
+	void reseed(uint64_t seed, uint64_t sequence);
+
+  private:
+	struct Component
+	{
+		float   value{0.0f};
+		float   backup{0.0f};
+		int64_t modified{0};               // iteration of the last mutation
+		int64_t backup_modified{0};
+	};
+
+	// Brings the component up to the current iteration
+	void ensure_ready(size_t index);
+
+	Rng                    rng_;
+	std::vector<Component> components_;
+	float                  sigma_{0.01f};
+	float                  large_step_probability_{0.3f};
+	int64_t                iteration_{0};
+	int64_t                last_large_step_{0};
+	bool                   large_step_{true};
+	size_t                 index_{0};
+};
+
+// State of one chain between mutations
+struct MetropolisChain
+{
+	PrimarySampleSpace primary_sample;
+	Rng                rng;                 // acceptance, kept apart from the mutations
+	glm::vec3          radiance{0.0f};
+	uint32_t           x{0};
+	uint32_t           y{0};
+};
+}        // namespace mengze::rt
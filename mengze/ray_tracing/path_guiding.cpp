@@ -0,0 +1,358 @@
+#include "ray_tracing/path_guiding.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ray_tracing/math.h"
+
+namespace mengze::rt
+{
+namespace
+{
+// Cylindrical coordinates, equal areas of the square map to equal solid angles
+glm::vec2 direction_to_square(const glm::vec3 &direction)
+{
+	float cos_theta = std::clamp(direction.z, -1.0f, 1.0f);
+	float phi       = std::atan2(direction.y, direction.x);
+	if (phi < 0.0f)
+	{
+		phi += 2.0f * glm::pi<float>();
+	}
+	return {std::clamp((cos_theta + 1.0f) * 0.5f, 0.0f, 1.0f), std::clamp(phi / (2.0f * glm::pi<float>()), 0.0f, 1.0f)};
+}
+
+glm::vec3 square_to_direction(const glm::vec2 &p)
+{
+	float cos_theta = 2.0f * p.x - 1.0f;
+	float sin_theta = std::sqrt(std::max(1.0f - cos_theta * cos_theta, 0.0f));
+	float phi       = 2.0f * glm::pi<float>() * p.y;
+	return {sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta};
+}
+
+// Quadrant of p in the unit square, 0 and 1 on the bottom row, and p mapped into that quadrant
+int child_quadrant(glm::vec2 &p)
+{
+	int x = p.x < 0.5f ? 0 : 1;
+	int y = p.y < 0.5f ? 0 : 1;
+	p     = glm::min(p * 2.0f - glm::vec2(x, y), glm::vec2(1.0f));
+	return x + 2 * y;
+}
+}        // namespace
+
+DTree::Node::Node() :
+    children{0, 0, 0, 0}
+{
+	for (auto &sum : sums)
+	{
+		sum.store(0.0f, std::memory_order_relaxed);
+	}
+}
+
+DTree::Node::Node(const Node &other)
+{
+	*this = other;
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		sums[i].store(other.sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		children[i] = other.children[i];
+	}
+	return *this;
+}
+
+DTree::DTree() :
+    nodes_(1)
+{
+}
+
+DTree::DTree(const DTree &other) :
+    nodes_(other.nodes_),
+    sample_count_(other.sample_count_.load())
+{
+}
+
+DTree &DTree::operator=(const DTree &other)
+{
+	nodes_ = other.nodes_;
+	sample_count_.store(other.sample_count_.load());
+	return *this;
+}
+
+void DTree::record(const glm::vec2 &uv, float value)
+{
+	sample_count_.fetch_add(1, std::memory_order_relaxed);
+	if (!(value > 0.0f) || !std::isfinite(value))
+	{
+		return;
+	}
+
+	// Every level keeps the sum of its quadrants, so the value goes into each node on the way down
+	glm::vec2 p    = uv;
+	uint32_t  node = 0;
+	while (true)
+	{
+		int quadrant = child_quadrant(p);
+		atomic_add(nodes_[node].sums[quadrant], value);
+		if (nodes_[node].children[quadrant] == 0)
+		{
+			return;
+		}
+		node = nodes_[node].children[quadrant];
+	}
+}
+
+float DTree::pdf(glm::vec2 uv) const
+{
+	float    pdf  = 1.0f;
+	uint32_t node = 0;
+	while (true)
+	{
+		const auto &current = nodes_[node];
+		float       total   = 0.0f;
+		for (const auto &sum : current.sums)
+		{
+			total += sum.load(std::memory_order_relaxed);
+		}
+		if (total <= 0.0f)
+		{
+			return pdf;
+		}
+
+		int quadrant = child_quadrant(uv);
+		pdf *= 4.0f * current.sums[quadrant].load(std::memory_order_relaxed) / total;
+		if (pdf <= 0.0f || current.children[quadrant] == 0)
+		{
+			return pdf;
+		}
+		node = current.children[quadrant];
+	}
+}
+
+glm::vec2 DTree::sample(glm::vec2 u) const
+{
+	glm::vec2 origin{0.0f};
+	float     size = 1.0f;
+	uint32_t  node = 0;
+	while (true)
+	{
+		const auto &current = nodes_[node];
+		float       sums[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			sums[i] = current.sums[i].load(std::memory_order_relaxed);
+		}
+		float total = sums[0] + sums[1] + sums[2] + sums[3];
+		if (total <= 0.0f)
+		{
+			return origin + u * size;
+		}
+
+		// Column first, then the quadrant within the column, reusing the random numbers each time
+		float left = (sums[0] + sums[2]) / total;
+		int   x    = u.x < left ? 0 : 1;
+		u.x        = x == 0 ? u.x / left : (u.x - left) / (1.0f - left);
+
+		float column = sums[x] + sums[x + 2];
+		float bottom = sums[x] / column;
+		int   y      = u.y < bottom ? 0 : 1;
+		u.y          = y == 0 ? u.y / bottom : (u.y - bottom) / (1.0f - bottom);
+		u            = glm::clamp(u, 0.0f, 1.0f - 1e-6f);
+
+		size *= 0.5f;
+		origin += glm::vec2(x, y) * size;
+
+		int quadrant = x + 2 * y;
+		if (current.children[quadrant] == 0)
+		{
+			return origin + u * size;
+		}
+		node = current.children[quadrant];
+	}
+}
+
+DTree DTree::refined(float threshold, int max_depth) const
+{
+	DTree result;
+	float total = this->total();
+	if (total <= 0.0f)
+	{
+		return result;
+	}
+
+	float flux[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		flux[i] = nodes_[0].sums[i].load(std::memory_order_relaxed);
+	}
+	result.build(*this, 0, flux, 0, 1, threshold * total, max_depth);
+	return result;
+}
+
+void DTree::build(const DTree &source, uint32_t source_node, const float flux[4], uint32_t node, int depth, float threshold_flux, int max_depth)
+{
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		if (depth >= max_depth || flux[quadrant] <= threshold_flux)
+		{
+			continue;
+		}
+
+		// Quadrants that were leaves spread their flux evenly over the new children
+		uint32_t source_child = source_node != UINT32_MAX ? source.nodes_[source_node].children[quadrant] : 0;
+		float    child_flux[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			child_flux[i] = source_child != 0 ? source.nodes_[source_child].sums[i].load(std::memory_order_relaxed) : 0.25f * flux[quadrant];
+		}
+
+		auto child = static_cast<uint32_t>(nodes_.size());
+		nodes_.emplace_back();
+		nodes_[node].children[quadrant] = child;
+		build(source, source_child != 0 ? source_child : UINT32_MAX, child_flux, child, depth + 1, threshold_flux, max_depth);
+	}
+}
+
+float DTree::total() const
+{
+	float total = 0.0f;
+	for (const auto &sum : nodes_[0].sums)
+	{
+		total += sum.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+uint32_t DTree::sample_count() const
+{
+	return sample_count_.load(std::memory_order_relaxed);
+}
+
+void PathGuide::reset(const Aabb &bounds)
+{
+	min_       = bounds.min();
+	extent_    = glm::max(bounds.max() - bounds.min(), glm::vec3(1e-4f));
+	iteration_ = 0;
+	nodes_.assign(1, {});
+	dtrees_.assign(NORMAL_DIRECTIONS, {});
+}
+
+uint32_t PathGuide::leaf(const glm::vec3 &p, const glm::vec3 &n) const
+{
+	glm::vec3 local = glm::clamp((p - min_) / extent_, 0.0f, 1.0f);
+	uint32_t  node  = 0;
+	while (nodes_[node].children[0] != 0)
+	{
+		const auto &current = nodes_[node];
+		int         child   = local[current.axis] < 0.5f ? 0 : 1;
+		local[current.axis] = std::min(local[current.axis] * 2.0f - static_cast<float>(child), 1.0f);
+		node                = current.children[child];
+	}
+
+	return nodes_[node].dtree + normal_class(n);
+}
+
+glm::vec3 PathGuide::sample(uint32_t leaf, const glm::vec2 &u) const
+{
+	return square_to_direction(dtrees_[leaf].sampling.sample(u));
+}
+
+float PathGuide::pdf(uint32_t leaf, const glm::vec3 &direction) const
+{
+	return dtrees_[leaf].sampling.pdf(direction_to_square(glm::normalize(direction))) / (4.0f * glm::pi<float>());
+}
+
+void PathGuide::record(uint32_t leaf, const glm::vec3 &direction, float value)
+{
+	dtrees_[leaf].building.record(direction_to_square(glm::normalize(direction)), value);
+}
+
+void PathGuide::update()
+{
+	// Split leaves with many samples, assuming they halve with every split
+	float threshold = SPATIAL_SPLIT_FACTOR * std::sqrt(std::pow(2.0f, static_cast<float>(iteration_)));
+
+	struct Pending
+	{
+		uint32_t node;
+		int      depth;
+		float    samples;
+	};
+	std::vector<Pending> stack{{0, 0, 0.0f}};
+	while (!stack.empty())
+	{
+		Pending pending = stack.back();
+		stack.pop_back();
+
+		if (nodes_[pending.node].children[0] != 0)
+		{
+			for (auto child : nodes_[pending.node].children)
+			{
+				stack.push_back({child, pending.depth + 1, 0.0f});
+			}
+			continue;
+		}
+
+		float samples = pending.samples > 0.0f ? pending.samples : static_cast<float>(leaf_sample_count(nodes_[pending.node].dtree));
+		if (samples <= threshold || pending.depth >= MAX_SPATIAL_DEPTH)
+		{
+			continue;
+		}
+
+		// Both halves start from the parent's trees
+		uint32_t dtree = nodes_[pending.node].dtree;
+		auto     first = static_cast<uint32_t>(nodes_.size());
+		for (uint32_t i = 0; i < 2; ++i)
+		{
+			SpatialNode child;
+			child.axis = static_cast<uint8_t>((nodes_[pending.node].axis + 1) % 3);
+			if (i == 0)
+			{
+				child.dtree = dtree;
+			}
+			else
+			{
+				child.dtree = static_cast<uint32_t>(dtrees_.size());
+				for (int j = 0; j < NORMAL_DIRECTIONS; ++j)
+				{
+					dtrees_.push_back(dtrees_[dtree + j]);
+				}
+			}
+			nodes_.push_back(child);
+		}
+		nodes_[pending.node].children[0] = first;
+		nodes_[pending.node].children[1] = first + 1;
+		stack.push_back({first, pending.depth + 1, 0.5f * samples});
+		stack.push_back({first + 1, pending.depth + 1, 0.5f * samples});
+	}
+
+	for (auto &pair : dtrees_)
+	{
+		pair.sampling = pair.building;
+		pair.building = pair.building.refined(DIRECTIONAL_SPLIT, MAX_DIRECTIONAL_DEPTH);
+	}
+	++iteration_;
+}
+
+bool PathGuide::is_trained() const
+{
+	return iteration_ > 0;
+}
+
+size_t PathGuide::leaf_count() const
+{
+	return dtrees_.size() / NORMAL_DIRECTIONS;
+}
+
+uint32_t PathGuide::leaf_sample_count(uint32_t dtree) const
+{
+	uint32_t count = 0;
+	for (int i = 0; i < NORMAL_DIRECTIONS; ++i)
+	{
+		count += dtrees_[dtree + i].building.sample_count();
+	}
+	return count;
+}
+}        // namespace mengze::rt
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/aabb.h"
+
+namespace mengze::rt
+{
+/**
+ * @brief Quadtree over the square of cylindrical direction coordinates, piecewise constant density.
+ *
+ * Every node stores the radiance recorded into each of its four quadrants, so sampling and evaluating
+ * the density only need a descent from the root. Recording is lock free and may run on many threads.
+ */
+class DTree
+{
+  public:
+	DTree();
+
+	DTree(const DTree &other);
+
+	DTree &operator=(const DTree &other);
+
+	// Adds a radiance estimate for the direction at uv
+	void record(const glm::vec2 &uv, float value);
+
+	// Density over the unit square, uniform while nothing was recorded
+	float pdf(glm::vec2 uv) const;
+
+	glm::vec2 sample(glm::vec2 u) const;
+
+	/**
+	 * @brief Tree with the structure for the next iteration and nothing recorded: quadrants holding more
+	 * than threshold of the total are split, the others are collapsed.
+	 */
+	DTree refined(float threshold, int max_depth) const;
+
+	float total() const;
+
+	uint32_t sample_count() const;
+
+  private:
+	struct Node
+	{
+		std::atomic<float> sums[4];
+		uint32_t           children[4];        // 0 for quadrants that are leaves, the root is never a child
+
+		Node();
+
+		Node(const Node &other);
+
+		Node &operator=(const Node &other);
+	};
+
+	void build(const DTree &source, uint32_t source_node, const float flux[4], uint32_t node, int depth, float threshold_flux, int max_depth);
+
+	std::vector<Node>     nodes_;
+	std::atomic<uint32_t> sample_count_{0};
+};
+
+/**
+ * @brief Spatio-directional tree for path guiding (Müller et al. 2017).
+ *
+ * A binary tree over the scene bounds, split along x, y and z in turn, holds pairs of DTrees in every
+ * leaf: one that is sampled and one that records the radiance of the current training iteration. When
+ * an iteration ends, leaves that recorded many samples are split in two, the recorded trees become the
+ * sampled ones and the recording starts over on refined trees.
+ *
+ * Unlike the paper, a leaf keeps one pair per dominant axis and sign of the surface normal. A leaf in a
+ * corner would otherwise learn the floor's light for the walls, and send their samples below the surface.
+ */
+class PathGuide
+{
+  public:
+	// Starts over with a single leaf covering bounds and nothing learned
+	void reset(const Aabb &bounds);
+
+	// Directional trees for a point p with the normal n, from the spatial leaf that contains p
+	uint32_t leaf(const glm::vec3 &p, const glm::vec3 &n) const;
+
+	glm::vec3 sample(uint32_t leaf, const glm::vec2 &u) const;
+
+	// Solid angle density of sample()
+	float pdf(uint32_t leaf, const glm::vec3 &direction) const;
+
+	// Adds an estimate of the incident radiance from direction, divided by the pdf it was sampled with
+	void record(uint32_t leaf, const glm::vec3 &direction, float value);
+
+	// Ends a training iteration, iterations are meant to double in length
+	void update();
+
+	// False until the first iteration ended
+	bool is_trained() const;
+
+	size_t leaf_count() const;
+
+  private:
+	uint32_t leaf_sample_count(uint32_t dtree) const;
+
+  private:
+	struct SpatialNode
+	{
+		uint32_t children[2]{0, 0};        // 0 for leaves
+		uint32_t dtree{0};                 // index of the leaf's first pair of trees, one per normal direction
+		uint8_t  axis{0};
+	};
+
+	struct DTreePair
+	{
+		DTree sampling;
+		DTree building;
+	};
+
+	static constexpr int   NORMAL_DIRECTIONS     = 6;
+	static constexpr float SPATIAL_SPLIT_FACTOR  = 12000.0f;        // samples per leaf times sqrt(2^iteration)
+	static constexpr int   MAX_SPATIAL_DEPTH     = 48;
+	static constexpr float DIRECTIONAL_SPLIT     = 0.01f;           // fraction of a leaf's flux
+	static constexpr int   MAX_DIRECTIONAL_DEPTH = 20;
+
+	std::vector<SpatialNode> nodes_;
+	std::vector<DTreePair>   dtrees_;
+
+	glm::vec3 min_{0.0f};
+	glm::vec3 extent_{1.0f};
+	int       iteration_{0};
+};
+}        // namespace mengze::rt
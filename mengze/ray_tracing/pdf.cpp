@@ -1,5 +1,7 @@
 #include "pdf.h"
 
+#include <type_traits>
+
 namespace mengze::rt
 {
 
@@ -14,26 +16,9 @@ float CosinePdf::value(const glm::vec3 &direction) const
 	return (cosine <= 0) ? 0 : cosine / glm::pi<float>();
 }
 
-glm::vec3 CosinePdf::generate() const
-{
-	return uvw_.to_local(random_cosine_direction());
-}
-
-MixturePdf::MixturePdf(std::shared_ptr<Pdf> p0, std::shared_ptr<Pdf> p1, float wight) :
-    p0_(std::move(p0)), p1_(std::move(p1)), wight_(wight)
-{}
-
-float MixturePdf::value(const glm::vec3 &direction) const
+glm::vec3 CosinePdf::generate(Sampler &sampler) const
 {
-	return wight_ * p0_->value(direction) + (1-wight_) * p1_->value(direction);
-}
-
-glm::vec3 MixturePdf::generate() const
-{
-	if (random_float() < wight_)
-		return p0_->generate();
-	else
-		return p1_->generate();
+	return uvw_.to_local(random_cosine_direction(sampler.get_2d()));
 }
 
 PhongPdf::PhongPdf(const glm::vec3 &w, const glm::vec3 &reflect_dir, float ns, float kd, float ks)
@@ -62,17 +47,17 @@ float PhongPdf::value(const glm::vec3 &direction) const
 }
 
 
-glm::vec3 PhongPdf::generate() const
+glm::vec3 PhongPdf::generate(Sampler &sampler) const
 {
-	if (random_float() < kd_ / (kd_ + ks_))
+	if (sampler.get_1d() < kd_ / (kd_ + ks_))
 	{
 		// Sample diffuse component
-		return uvw_.to_local(random_cosine_direction());
+		return uvw_.to_local(random_cosine_direction(sampler.get_2d()));
 	}
 	else
 	{
 		// Sample specular component
-		return random_phong_specular_direction();
+		return random_phong_specular_direction(sampler);
 	}
 }
 
@@ -88,11 +73,12 @@ glm::vec3 align_direction_with(const glm::vec3 &local_direction, const glm::vec3
 	return local_direction.x * u + local_direction.y * v + local_direction.z * w;
 }
 
-glm::vec3 PhongPdf::random_phong_specular_direction() const
+glm::vec3 PhongPdf::random_phong_specular_direction(Sampler &sampler) const
 {
 	// Step 1: Generate two random numbers
-	float u1 = random_float();
-	float u2 = random_float();
+	glm::vec2 u  = sampler.get_2d();
+	float     u1 = u.x;
+	float     u2 = u.y;
 
 	// Step 2: Convert uniform random numbers to concentration around specular direction
 	float phi = 2 * glm::pi<float>() * u1;        // Full circle
@@ -113,4 +99,28 @@ glm::vec3 PhongPdf::random_phong_specular_direction() const
 
 	return world_direction;
 }
+
+float ScatterPdf::value(const glm::vec3 &direction) const
+{
+	return std::visit(
+	    [&direction](const auto &pdf) {
+		    if constexpr (std::is_same_v<std::decay_t<decltype(pdf)>, std::monostate>)
+			    return 0.0f;
+		    else
+			    return pdf.value(direction);
+	    },
+	    pdf_);
+}
+
+glm::vec3 ScatterPdf::generate(Sampler &sampler) const
+{
+	return std::visit(
+	    [&sampler](const auto &pdf) {
+		    if constexpr (std::is_same_v<std::decay_t<decltype(pdf)>, std::monostate>)
+			    return glm::vec3{0.0f};
+		    else
+			    return pdf.generate(sampler);
+	    },
+	    pdf_);
+}
 }
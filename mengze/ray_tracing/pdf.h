@@ -1,63 +1,68 @@
 #pragma once
+#include <variant>
+
 #include "ray_tracing/math.h"
+#include "ray_tracing/sampler.h"
 
 namespace mengze::rt
 {
-class Pdf
-{
-  public:
-	virtual ~Pdf() = default;
-
-	virtual float value(const glm::vec3 &direction) const = 0;
-
-	virtual glm::vec3 generate() const = 0;
-};
+// Densities are plain value types with value() and generate(), they are built on the stack for every
+// vertex, so none of them may allocate
 
-class CosinePdf : public Pdf
+class CosinePdf
 {
   public:
 	CosinePdf(const glm::vec3 &w);
 
-	float value(const glm::vec3 &direction) const override;
+	float value(const glm::vec3 &direction) const;
 
-	glm::vec3 generate() const override;
+	glm::vec3 generate(Sampler &sampler) const;
 
   private:
 	OrthoNormalBasis uvw_;
 };
 
-class MixturePdf : public Pdf
+class PhongPdf
 {
   public:
-	MixturePdf(std::shared_ptr<Pdf> p0, std::shared_ptr<Pdf> p1, float wight = 0.5);
+	PhongPdf(const glm::vec3 &w, const glm::vec3 &reflect_dir, float ns, float kd, float ks);
 
-	float value(const glm::vec3 &direction) const override;
+	float value(const glm::vec3 &direction) const;
 
-	glm::vec3 generate() const override;
+	glm::vec3 generate(Sampler &sampler) const;
 
-  private:
-	std::shared_ptr<Pdf> p0_;
-	std::shared_ptr<Pdf> p1_;
+	glm::vec3 random_phong_specular_direction(Sampler &sampler) const;
 
-	float wight_{0.5};
+  private:
+	OrthoNormalBasis uvw_;
+	glm::vec3        reflect_dir_;
+	float            ns_;
+	float            kd_;
+	float            ks_;
 };
 
-class PhongPdf : public Pdf
+/**
+ * @brief Density a material leaves in its ScatterRecord, one of the material densities held in place.
+ * Empty for materials that choose their ray themselves, where value() is 0.
+ */
+class ScatterPdf
 {
   public:
-	PhongPdf(const glm::vec3 &w, const glm::vec3 &reflect_dir, float ns, float kd, float ks);
+	ScatterPdf() = default;
+
+	ScatterPdf(const CosinePdf &pdf) :
+	    pdf_(pdf)
+	{}
 
-	float value(const glm::vec3 &direction) const override;
+	ScatterPdf(const PhongPdf &pdf) :
+	    pdf_(pdf)
+	{}
 
-	glm::vec3 generate() const override;
+	float value(const glm::vec3 &direction) const;
 
-	glm::vec3 random_phong_specular_direction() const;
+	glm::vec3 generate(Sampler &sampler) const;
 
   private:
-	OrthoNormalBasis uvw_;
-	glm::vec3        reflect_dir_;
-	float            ns_;
-	float            kd_;
-	float            ks_;
+	std::variant<std::monostate, CosinePdf, PhongPdf> pdf_;
 };
 }
@@ -0,0 +1,72 @@
+#include "ray_tracing/photon_map.h"
+
+#include <cmath>
+#include <execution>
+#include <numeric>
+
+namespace mengze::rt
+{
+void PhotonMap::build(std::vector<std::vector<Photon>> &buffers, float radius)
+{
+	radius_ = radius;
+
+	// Buffers are copied to their own ranges, so every buffer can be copied on its own thread
+	std::vector<size_t> offsets(buffers.size() + 1, 0);
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		offsets[i + 1] = offsets[i] + buffers[i].size();
+	}
+	unsorted_.resize(offsets.back());
+	std::vector<size_t> buffer_iter(buffers.size());
+	std::iota(buffer_iter.begin(), buffer_iter.end(), 0);
+	std::for_each(std::execution::par, buffer_iter.begin(), buffer_iter.end(), [this, &buffers, &offsets](size_t i) {
+		std::copy(buffers[i].begin(), buffers[i].end(), unsorted_.begin() + static_cast<std::ptrdiff_t>(offsets[i]));
+		buffers[i].clear();
+	});
+
+	// Twice as many buckets as photons keeps collisions rare
+	uint32_t bucket_count = 1;
+	while (bucket_count < 2 * unsorted_.size())
+	{
+		bucket_count <<= 1;
+	}
+	bucket_mask_ = bucket_count - 1;
+
+	hashes_.resize(unsorted_.size());
+	std::transform(std::execution::par, unsorted_.begin(), unsorted_.end(), hashes_.begin(), [this](const Photon &photon) { return hash(cell(photon.position)); });
+
+	// Counting sort by bucket
+	bucket_starts_.assign(bucket_count + 1, 0);
+	for (auto bucket : hashes_)
+	{
+		++bucket_starts_[bucket + 1];
+	}
+	std::partial_sum(bucket_starts_.begin(), bucket_starts_.end(), bucket_starts_.begin());
+
+	std::vector<uint32_t> cursors(bucket_starts_.begin(), bucket_starts_.end() - 1);
+	photons_.resize(unsorted_.size());
+	for (size_t i = 0; i < unsorted_.size(); ++i)
+	{
+		photons_[cursors[hashes_[i]]++] = unsorted_[i];
+	}
+}
+
+size_t PhotonMap::size() const
+{
+	return photons_.size();
+}
+
+glm::ivec3 PhotonMap::cell(const glm::vec3 &p) const
+{
+	return glm::ivec3(glm::floor(p / radius_));
+}
+
+uint32_t PhotonMap::hash(const glm::ivec3 &cell) const
+{
+	// Teschner et al. 2003
+	auto x = static_cast<uint32_t>(cell.x) * 73856093u;
+	auto y = static_cast<uint32_t>(cell.y) * 19349663u;
+	auto z = static_cast<uint32_t>(cell.z) * 83492791u;
+	return (x ^ y ^ z) & bucket_mask_;
+}
+}        // namespace mengze::rt
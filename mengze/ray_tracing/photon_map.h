@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace mengze::rt
+{
+struct Photon
+{
+	glm::vec3 position;
+	glm::vec3 direction;        // direction of travel when the photon arrived
+	glm::vec3 power;
+};
+
+/**
+ * @brief Photons of one pass hashed into a uniform grid, for lookups within a fixed radius.
+ *
+ * The grid is an array of cells sorted by the hash of their integer coordinates, so building it is a
+ * counting sort and a lookup visits the 27 cells around a point. Cells are as large as the lookup
+ * radius, hash collisions only cost the distance test of photons from other cells.
+ */
+class PhotonMap
+{
+  public:
+	// Moves the photons of every buffer into the grid, the buffers are left empty with their capacity
+	void build(std::vector<std::vector<Photon>> &buffers, float radius);
+
+	// Calls f for every photon within the radius the grid was built with
+	template <typename F>
+	void for_each_near(const glm::vec3 &p, F &&f) const
+	{
+		if (photons_.empty())
+		{
+			return;
+		}
+
+		// Neighbouring cells may share a bucket, which must still be visited once
+		glm::ivec3 center = cell(p);
+		uint32_t   visited[27];
+		int        visited_count  = 0;
+		float      radius_squared = radius_ * radius_;
+		for (int z = -1; z <= 1; ++z)
+		{
+			for (int y = -1; y <= 1; ++y)
+			{
+				for (int x = -1; x <= 1; ++x)
+				{
+					uint32_t bucket = hash(center + glm::ivec3(x, y, z));
+					if (std::find(visited, visited + visited_count, bucket) != visited + visited_count)
+					{
+						continue;
+					}
+					visited[visited_count++] = bucket;
+
+					for (uint32_t i = bucket_starts_[bucket]; i < bucket_starts_[bucket + 1]; ++i)
+					{
+						glm::vec3 offset = photons_[i].position - p;
+						if (glm::dot(offset, offset) < radius_squared)
+						{
+							f(photons_[i]);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	size_t size() const;
+
+  private:
+	glm::ivec3 cell(const glm::vec3 &p) const;
+
+	uint32_t hash(const glm::ivec3 &cell) const;
+
+	std::vector<Photon>   photons_;
+	std::vector<uint32_t> bucket_starts_;        // photons of bucket b are [bucket_starts_[b], bucket_starts_[b + 1])
+	std::vector<uint32_t> hashes_;
+	std::vector<Photon>   unsorted_;
+
+	float    radius_{1.0f};
+	uint32_t bucket_mask_{0};
+};
+}        // namespace mengze::rt
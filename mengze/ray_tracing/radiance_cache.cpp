@@ -0,0 +1,185 @@
+#include "ray_tracing/radiance_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+
+#include "ray_tracing/math.h"
+
+namespace mengze::rt
+{
+namespace
+{
+// Finalizer of splitmix64
+uint64_t mix(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+}        // namespace
+
+void RadianceCache::reset(float cell_size)
+{
+	cells_     = std::vector<Cell>(CAPACITY);
+	cell_size_ = cell_size;
+	frame_     = 1;
+}
+
+float RadianceCache::cell_size() const
+{
+	return cell_size_;
+}
+
+uint64_t RadianceCache::key(const glm::vec3 &p, const glm::vec3 &n, float footprint) const
+{
+	int   level = std::clamp(static_cast<int>(std::ceil(std::log2(std::max(footprint / cell_size_, 1.0f)))), 0, MAX_LEVEL);
+	float size  = std::ldexp(cell_size_, level);
+
+	// 18 bits per axis around the origin, 4 for the level, 3 for the normal and the top bit so that no key is 0
+	// or TOMBSTONE_KEY
+	glm::vec3 cell = glm::floor(p / size);
+	uint64_t  x    = static_cast<uint64_t>(static_cast<int64_t>(cell.x) + (1 << 17)) & 0x3ffff;
+	uint64_t  y    = static_cast<uint64_t>(static_cast<int64_t>(cell.y) + (1 << 17)) & 0x3ffff;
+	uint64_t  z    = static_cast<uint64_t>(static_cast<int64_t>(cell.z) + (1 << 17)) & 0x3ffff;
+
+	return (1ull << 63) | (x << 43) | (y << 25) | (z << 7) | (static_cast<uint64_t>(level) << 3) | static_cast<uint64_t>(normal_class(n));
+}
+
+uint32_t RadianceCache::find(uint64_t key) const
+{
+	// Probing stops at the first free cell, evicted cells are tombstones and do not end the chain
+	auto index = static_cast<uint32_t>(mix(key)) & (CAPACITY - 1);
+	for (uint32_t probe = 0; probe < MAX_PROBES; ++probe, index = (index + 1) & (CAPACITY - 1))
+	{
+		uint64_t current = cells_[index].key.load(std::memory_order_acquire);
+		if (current == key)
+		{
+			return index;
+		}
+		if (current == 0)
+		{
+			return UINT32_MAX;
+		}
+	}
+	return UINT32_MAX;
+}
+
+uint32_t RadianceCache::insert(const glm::vec3 &p, const glm::vec3 &n, float footprint)
+{
+	uint64_t cell_key = key(p, n, footprint);
+	auto     start    = static_cast<uint32_t>(mix(cell_key)) & (CAPACITY - 1);
+
+	// Cells only go from free or tombstone to taken during a frame, so threads inserting the same key pick the
+	// same first unused cell, and a lost exchange only has to look at the chain again
+	while (true)
+	{
+		uint32_t target   = UINT32_MAX;
+		uint64_t expected = 0;
+		auto     index    = start;
+		for (uint32_t probe = 0; probe < MAX_PROBES; ++probe, index = (index + 1) & (CAPACITY - 1))
+		{
+			uint64_t current = cells_[index].key.load(std::memory_order_acquire);
+			if (current == cell_key)
+			{
+				return index;
+			}
+			if ((current == 0 || current == TOMBSTONE_KEY) && target == UINT32_MAX)
+			{
+				target   = index;
+				expected = current;
+			}
+			if (current == 0)
+			{
+				break;
+			}
+		}
+
+		if (target == UINT32_MAX)
+		{
+			return UINT32_MAX;
+		}
+		if (cells_[target].key.compare_exchange_strong(expected, cell_key, std::memory_order_acq_rel))
+		{
+			return target;
+		}
+		// A failed exchange leaves the key another thread stored, which may be this one
+		if (expected == cell_key)
+		{
+			return target;
+		}
+	}
+}
+
+void RadianceCache::add_sample(uint32_t cell, const glm::vec3 &radiance)
+{
+	if (!std::isfinite(radiance.x) || !std::isfinite(radiance.y) || !std::isfinite(radiance.z))
+	{
+		return;
+	}
+
+	auto &target = cells_[cell];
+	for (int i = 0; i < 3; ++i)
+	{
+		atomic_add(target.sums[i], radiance[i]);
+	}
+	target.count.fetch_add(1, std::memory_order_relaxed);
+	target.last_used.store(frame_, std::memory_order_relaxed);
+}
+
+bool RadianceCache::lookup(const glm::vec3 &p, const glm::vec3 &n, float footprint, glm::vec3 &radiance) const
+{
+	uint32_t cell = find(key(p, n, footprint));
+	if (cell == UINT32_MAX)
+	{
+		return false;
+	}
+
+	const auto &source = cells_[cell];
+	source.last_used.store(frame_, std::memory_order_relaxed);
+	if (source.history < MIN_SAMPLES)
+	{
+		return false;
+	}
+	radiance = source.radiance;
+	return true;
+}
+
+void RadianceCache::resolve()
+{
+	std::for_each(std::execution::par, cells_.begin(), cells_.end(), [this](Cell &cell) {
+		uint64_t key = cell.key.load(std::memory_order_relaxed);
+		if (key == 0 || key == TOMBSTONE_KEY)
+		{
+			return;
+		}
+
+		uint32_t count = cell.count.exchange(0, std::memory_order_relaxed);
+		if (count > 0)
+		{
+			glm::vec3 sum(cell.sums[0].exchange(0.0f, std::memory_order_relaxed), cell.sums[1].exchange(0.0f, std::memory_order_relaxed),
+			              cell.sums[2].exchange(0.0f, std::memory_order_relaxed));
+
+			// Earlier samples keep at most MAX_HISTORY - count of the weight
+			uint32_t history = std::min(cell.history, MAX_HISTORY > count ? MAX_HISTORY - count : 0u);
+			cell.radiance    = (cell.radiance * static_cast<float>(history) + sum) / static_cast<float>(history + count);
+			cell.history     = history + count;
+		}
+		else if (frame_ - cell.last_used.load(std::memory_order_relaxed) > MAX_IDLE_FRAMES)
+		{
+			cell.radiance = glm::vec3{0.0f};
+			cell.history  = 0;
+			cell.key.store(TOMBSTONE_KEY, std::memory_order_release);
+		}
+	});
+	++frame_;
+}
+
+size_t RadianceCache::cell_count() const
+{
+	return std::count_if(cells_.begin(), cells_.end(), [](const Cell &cell) {
+		uint64_t key = cell.key.load(std::memory_order_relaxed);
+		return key != 0 && key != TOMBSTONE_KEY;
+	});
+}
+}        // namespace mengze::rt
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace mengze::rt
+{
+/**
+ * @brief World-space cache of the radiance that diffuse surfaces reflect, in a fixed-size hash table.
+ *
+ * Cells are keyed on the position quantized to the cell size and on the dominant axis and sign of the
+ * normal, and found by linear probing. Callers ask for cells about as large as the footprint they need,
+ * usually a few pixels seen from the camera, which is rounded up to the base size times a power of two.
+ * Samples are added lock free while a frame renders and blended into the cells' radiance by resolve()
+ * between frames, so lookups during a frame see what earlier frames learned. The blend keeps a limited
+ * history so that cells follow changes of the lighting, and cells nobody looked up or wrote for a while
+ * are evicted to make room for what the camera sees now. Evicted cells become tombstones, which probing
+ * walks past and insert() reuses.
+ */
+class RadianceCache
+{
+  public:
+	// Empties the cache and allocates its cells, the smallest cells are cubes of size cell_size
+	void reset(float cell_size);
+
+	float cell_size() const;
+
+	// Cell of a surface point for add_sample(), inserted if missing, UINT32_MAX when the table is too full
+	uint32_t insert(const glm::vec3 &p, const glm::vec3 &n, float footprint);
+
+	// Adds an estimate of the radiance the surface of the cell reflects, may run on many threads
+	void add_sample(uint32_t cell, const glm::vec3 &radiance);
+
+	// Radiance reflected around the point, false while its cell has fewer than MIN_SAMPLES samples
+	bool lookup(const glm::vec3 &p, const glm::vec3 &n, float footprint, glm::vec3 &radiance) const;
+
+	// Ends a frame: blends the frame's samples into the cells and evicts cells that went unused
+	void resolve();
+
+	size_t cell_count() const;
+
+  private:
+	struct Cell
+	{
+		std::atomic<uint64_t>         key{0};        // 0 for free cells, TOMBSTONE_KEY for evicted ones
+		std::atomic<float>            sums[3]{};
+		std::atomic<uint32_t>         count{0};
+		mutable std::atomic<uint32_t> last_used{0};        // frame of the last lookup or sample
+
+		glm::vec3 radiance{0.0f};
+		uint32_t  history{0};        // samples blended into radiance
+	};
+
+	uint64_t key(const glm::vec3 &p, const glm::vec3 &n, float footprint) const;
+
+	// Index of the cell with the key, UINT32_MAX if it is not in the table
+	uint32_t find(uint64_t key) const;
+
+	static constexpr uint64_t TOMBSTONE_KEY   = 1;        // never produced by key(), which sets the top bit
+	static constexpr uint32_t CAPACITY        = 1u << 19;
+	static constexpr uint32_t MAX_PROBES      = 16;
+	static constexpr uint32_t MIN_SAMPLES     = 8;
+	static constexpr uint32_t MAX_HISTORY     = 256;        // samples, older ones fade out
+	static constexpr uint32_t MAX_IDLE_FRAMES = 32;
+	static constexpr int      MAX_LEVEL       = 15;        // largest cells are 2^MAX_LEVEL times the smallest
+
+	std::vector<Cell> cells_;
+	float             cell_size_{0.0f};
+	uint32_t          frame_{1};
+};
+}        // namespace mengze::rt
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "glm/glm.hpp"
 
 namespace mengze::rt
@@ -11,8 +13,12 @@ class Ray
 
 	Ray(const glm::vec3 &origin, const glm::vec3 &direction) :
 	    origin_{origin},
-	    direction_{direction}
+	    direction_{direction},
+	    inv_direction_{1.0f / direction}
 	{
+		sign_[0] = inv_direction_.x < 0.0f;
+		sign_[1] = inv_direction_.y < 0.0f;
+		sign_[2] = inv_direction_.z < 0.0f;
 	}
 
 	glm::vec3 at(float t) const
@@ -29,8 +35,22 @@ class Ray
 		return direction_;
 	}
 
+	// Cached for the slab tests, every BVH node visited by the ray needs them
+	const glm::vec3 &inv_direction() const
+	{
+		return inv_direction_;
+	}
+
+	// 1 where the direction is negative on the axis, i.e. the ray enters a box through its max plane
+	int sign(int axis) const
+	{
+		return sign_[axis];
+	}
+
   private:
 	glm::vec3 origin_;
 	glm::vec3 direction_;
+	glm::vec3 inv_direction_;
+	uint8_t   sign_[3]{};
 };
 }        // namespace mengze
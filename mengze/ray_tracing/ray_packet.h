@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/ray.h"
+
+namespace mengze::rt
+{
+constexpr uint32_t RAY_PACKET_TILE = 8;
+constexpr uint32_t RAY_PACKET_SIZE = RAY_PACKET_TILE * RAY_PACKET_TILE;
+
+using LaneMask = uint64_t;
+
+static_assert(RAY_PACKET_SIZE <= 64, "Lane masks are 64 bit");
+
+inline int lowest_lane(LaneMask mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+/**
+ * @brief Coherent rays traced together, e.g. the camera rays of an 8x8 pixel block.
+ *
+ * Besides the rays themselves the packet keeps interval bounds of the origins and inverse
+ * directions, which let traversal reject a node for all lanes with a single interval arithmetic test.
+ */
+struct RayPacket
+{
+	Ray       rays[RAY_PACKET_SIZE];
+	float     t_max[RAY_PACKET_SIZE];
+	float     t_min{0.001f};
+	uint32_t  size{0};
+
+	glm::vec3 origin_min;
+	glm::vec3 origin_max;
+	glm::vec3 inv_direction_min;
+	glm::vec3 inv_direction_max;
+	bool      coherent[3]{};        // all lanes share the direction sign on this axis
+
+	void add(const Ray &ray, float max_t = std::numeric_limits<float>::infinity())
+	{
+		rays[size]  = ray;
+		t_max[size] = max_t;
+		++size;
+	}
+
+	LaneMask all_lanes() const
+	{
+		return size >= 64 ? ~LaneMask{0} : (LaneMask{1} << size) - 1;
+	}
+
+	// Must be called once all rays are added
+	void compute_bounds()
+	{
+		origin_min        = glm::vec3(std::numeric_limits<float>::infinity());
+		origin_max        = glm::vec3(-std::numeric_limits<float>::infinity());
+		inv_direction_min = glm::vec3(std::numeric_limits<float>::infinity());
+		inv_direction_max = glm::vec3(-std::numeric_limits<float>::infinity());
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			origin_min        = glm::min(origin_min, rays[i].origin());
+			origin_max        = glm::max(origin_max, rays[i].origin());
+			inv_direction_min = glm::min(inv_direction_min, rays[i].inv_direction());
+			inv_direction_max = glm::max(inv_direction_max, rays[i].inv_direction());
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			bool same_sign = (inv_direction_min[axis] > 0.0f) == (inv_direction_max[axis] > 0.0f);
+			coherent[axis] = same_sign && std::isfinite(inv_direction_min[axis]) && std::isfinite(inv_direction_max[axis]);
+		}
+	}
+
+	/**
+	 * @brief Conservative test of a box against every ray of the packet.
+	 * @return false only if no ray can hit the box within [t_min, max_t]
+	 */
+	bool may_hit(const glm::vec3 &box_min, const glm::vec3 &box_max, float max_t) const
+	{
+		float t_enter = t_min;
+		float t_exit  = max_t;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (!coherent[axis])
+			{
+				continue;
+			}
+
+			bool  positive = inv_direction_min[axis] > 0.0f;
+			float near_lo  = positive ? interval_min(box_min[axis], axis) : interval_min(box_max[axis], axis);
+			float far_hi   = positive ? interval_max(box_max[axis], axis) : interval_max(box_min[axis], axis);
+			t_enter        = std::max(t_enter, near_lo);
+			t_exit         = std::min(t_exit, far_hi);
+		}
+		return t_enter <= t_exit;
+	}
+
+  private:
+	// Bounds of (plane - origin) * inv_direction over all lanes
+	float interval_min(float plane, int axis) const
+	{
+		float d_lo = plane - origin_max[axis];
+		float d_hi = plane - origin_min[axis];
+		return std::min(std::min(d_lo * inv_direction_min[axis], d_lo * inv_direction_max[axis]),
+		                std::min(d_hi * inv_direction_min[axis], d_hi * inv_direction_max[axis]));
+	}
+
+	float interval_max(float plane, int axis) const
+	{
+		float d_lo = plane - origin_max[axis];
+		float d_hi = plane - origin_min[axis];
+		return std::max(std::max(d_lo * inv_direction_min[axis], d_lo * inv_direction_max[axis]),
+		                std::max(d_hi * inv_direction_min[axis], d_hi * inv_direction_max[axis]));
+	}
+};
+}        // namespace mengze::rt
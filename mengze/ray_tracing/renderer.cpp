@@ -1,6 +1,9 @@
 #include "ray_tracing/renderer.h"
 
+#include <algorithm>
 #include <execution>
+#include <functional>
+#include <numeric>
 
 #include "core/logging.h"
 #include "core/timer.h"
@@ -25,6 +28,53 @@
 
 namespace mengze::rt
 {
+namespace
+{
+constexpr uint32_t RESTIR_SEED = 0x9e3779b9u;
+constexpr uint32_t PHOTON_SEED = 0x85ebca6bu;
+constexpr uint32_t METROPOLIS_SEED = 0xc2b2ae35u;
+
+// Reciprocal of every channel, 0 for channels that are 0
+glm::vec3 safe_inverse(const glm::vec3 &v)
+{
+	return {v.x > 0.0f ? 1.0f / v.x : 0.0f, v.y > 0.0f ? 1.0f / v.y : 0.0f, v.z > 0.0f ? 1.0f / v.z : 0.0f};
+}
+
+// Reuse only between pixels that see roughly the same surface
+bool is_similar_surface(const RestirSurface &surface, const HitRecord &rec)
+{
+	return glm::dot(surface.normal, rec.normal) > 0.9f && std::fabs(surface.depth - rec.t) < 0.1f * rec.t;
+}
+
+// Blue four times below the threshold, green at it, red four times above
+glm::vec3 heatmap_color(float relative_error)
+{
+	float t = std::clamp(0.5f + 0.25f * std::log2(relative_error), 0.0f, 1.0f);
+	return t < 0.5f ? glm::mix(glm::vec3{0.0f, 0.0f, 1.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, 2.0f * t) :
+	                  glm::mix(glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec3{1.0f, 0.0f, 0.0f}, 2.0f * t - 1.0f);
+}
+}        // namespace
+
+const char *to_string(IntegratorType type)
+{
+	switch (type)
+	{
+		case IntegratorType::kPathTracer:
+			return "path tracer";
+		case IntegratorType::kRestirDi:
+			return "ReSTIR DI";
+		case IntegratorType::kWavefront:
+			return "wavefront path tracer";
+		case IntegratorType::kPhotonMapping:
+			return "progressive photon mapping";
+		case IntegratorType::kBidirectional:
+			return "bidirectional path tracer";
+		case IntegratorType::kMetropolis:
+			return "primary sample space MLT";
+	}
+	return "unknown";
+}
+
 Renderer::Renderer(const std::shared_ptr<mengze::rt::Camera> &camera) :
     mengze::Renderer(),
     camera_(camera)
@@ -44,6 +94,8 @@ Renderer::Renderer(const std::shared_ptr<mengze::rt::Camera> &camera, uint32_t s
 void Renderer::set_scene(const std::shared_ptr<mengze::rt::Scene> &scene)
 {
 	scene_ = scene;
+	scene_->build_top_level();
+	scene_->build_lights();
 }
 
 void Renderer::on_resize(uint32_t width, uint32_t height)
@@ -69,32 +121,104 @@ void Renderer::render()
 	if (frame_index_ == 1)
 	{
 		reset_accumulation();
+		adaptive_.resize(get_width(), get_height());
+		if (path_guiding_)
+		{
+			path_guide_->reset(scene_->top_level().bounding_box());
+		}
+		if (roulette_splitting_)
+		{
+			splitting_->reset(scene_->top_level().bounding_box());
+		}
+
+		// The cache outlives camera moves, only a scene of another size starts it over
+		if (radiance_caching_)
+		{
+			const Aabb &bounds    = scene_->top_level().bounding_box();
+			float       cell_size = RADIANCE_CACHE_CELL_FRACTION * glm::length(bounds.max() - bounds.min());
+			if (radiance_cache_->cell_size() != cell_size)
+			{
+				radiance_cache_->reset(cell_size);
+			}
+		}
 	}
-	if (frame_index_ > sample_per_pixel_)
+	if (is_finished())
 	{
+		if (display_dirty_)
+		{
+			update_display();
+		}
 		return;
 	}
 
+	scene_->build_top_level();
+	scene_->build_lights();
+	scene_->set_solid_angle_sampling(solid_angle_sampling_);
+
 	LOGI("Rendering frame: {}", frame_index_)
 #define MULTITHREAD_RENDER 1
 
 #if MULTITHREAD_RENDER
 	std::thread progress_thread(print_progress);
 
-	total_pixels = get_width() * get_height();
+	bool adaptive = is_adaptive();
+	total_pixels  = adaptive ? static_cast<int>(adaptive_.active_pixel_count()) : get_width() * get_height();
 
-	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this](uint32_t y) {
-		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, y](uint32_t x) {
-			Ray       ray   = camera_->get_ray(x, y);
-			glm::vec3 color = ray_color(ray, max_depth_);
-			get_pixel_accumulation(x, y) += color;
-			glm::vec3 accumulated_color = get_pixel_accumulation(x, y);
-			accumulated_color /= static_cast<float>(frame_index_);
+	if (integrator_ == IntegratorType::kRestirDi)
+	{
+		render_restir();
+	}
+	else if (integrator_ == IntegratorType::kWavefront)
+	{
+		render_wavefront();
+	}
+	else if (integrator_ == IntegratorType::kPhotonMapping)
+	{
+		render_photon_mapping();
+	}
+	else if (integrator_ == IntegratorType::kBidirectional)
+	{
+		render_bidirectional();
+	}
+	else if (integrator_ == IntegratorType::kMetropolis)
+	{
+		render_metropolis();
+	}
+	else if (packet_tracing_)
+	{
+		uint32_t tiles_x = (get_width() + RAY_PACKET_TILE - 1) / RAY_PACKET_TILE;
+		uint32_t tiles_y = (get_height() + RAY_PACKET_TILE - 1) / RAY_PACKET_TILE;
+		if (adaptive)
+		{
+			tile_iter_ = adaptive_.active_tiles();
+		}
+		else
+		{
+			tile_iter_.resize(tiles_x * tiles_y);
+			for (uint32_t i = 0; i < tile_iter_.size(); ++i)
+			{
+				tile_iter_[i] = i;
+			}
+		}
 
-			set_pixel(x, y, accumulated_color);
-			++pixels_rendered;
+		std::for_each(std::execution::par, tile_iter_.begin(), tile_iter_.end(), [this, tiles_x](uint32_t tile) {
+			render_tile(tile % tiles_x, tile / tiles_x);
 		});
-	});
+	}
+	else
+	{
+		std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this, adaptive](uint32_t y) {
+			std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, adaptive, y](uint32_t x) {
+				if (adaptive && !adaptive_.is_active(x, y))
+				{
+					return;
+				}
+				Sampler sampler = pixel_sampler(x, y);
+				Ray     ray     = camera_->get_ray(x, y, sampler);
+				render_pixel(x, y, ray_color(ray, max_depth_, sampler));
+			});
+		});
+	}
 
 	progress_thread.join();
 	pixels_rendered = 0;
@@ -104,81 +228,1165 @@ void Renderer::render()
 	{
 		for (uint32_t x = 0; x < get_width(); ++x)
 		{
-			Ray       ray   = camera_->get_ray(x, y);
-			glm::vec3 color = ray_color(ray, max_depth_);
-			get_pixel_accumulation(x, y) += color;
-			glm::vec3 accumulated_color = get_pixel_accumulation(x, y);
-			accumulated_color /= static_cast<float>(frame_index_);
-
-			set_pixel(x, y, accumulated_color);
+			Sampler sampler = pixel_sampler(x, y);
+			Ray     ray     = camera_->get_ray(x, y, sampler);
+			render_pixel(x, y, ray_color(ray, max_depth_, sampler));
 		}
 	}
 #endif
+	if (adaptive_sampling_ || noise_heatmap_)
+	{
+		adaptive_.update_tiles(adaptive_options(), adaptive);
+	}
+	if (noise_heatmap_ || display_dirty_)
+	{
+		update_display();
+	}
+
+	// Training iterations double in length, so the guide is rebuilt after frames 1, 3, 7, 15 and so on
+	if (path_guiding_ && (frame_index_ & (frame_index_ + 1)) == 0)
+	{
+		path_guide_->update();
+		LOGI("Path guiding: {} spatial leaves after frame {}", path_guide_->leaf_count(), frame_index_)
+	}
+
+	if (radiance_caching_)
+	{
+		radiance_cache_->resolve();
+	}
+
+	if (roulette_splitting_)
+	{
+		splitting_->update(adaptive_.relative_variance());
+	}
+
 	if (is_accumulation_)
 	{
 		frame_index_++;
 	}
+
+	if (adaptive && is_finished())
+	{
+		LOGI("Adaptive sampling done after {} frames, {:.1f} samples per pixel on average, {} tiles left active", frame_index_ - 1,
+		     static_cast<double>(adaptive_.total_samples()) / (static_cast<double>(get_width()) * get_height()), adaptive_.active_tiles().size())
+	}
+}
+
+bool Renderer::is_adaptive() const
+{
+	return adaptive_sampling_ && integrator_ == IntegratorType::kPathTracer;
+}
+
+bool Renderer::is_finished() const
+{
+	if (!is_adaptive())
+	{
+		return frame_index_ > sample_per_pixel_;
+	}
+
+	uint64_t budget = static_cast<uint64_t>(sample_per_pixel_) * get_width() * get_height();
+	return adaptive_.active_tiles().empty() || adaptive_.total_samples() >= budget;
+}
+
+AdaptiveSamplingOptions Renderer::adaptive_options() const
+{
+	AdaptiveSamplingOptions options = adaptive_options_;
+	if (options.max_samples == 0)
+	{
+		options.max_samples = ADAPTIVE_MAX_SAMPLE_FACTOR * sample_per_pixel_;
+	}
+	return options;
 }
 
-glm::vec3 Renderer::ray_color(const Ray &r, int depth) const
+void Renderer::update_display()
 {
+	float threshold = adaptive_options_.error_threshold;
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this, threshold](uint32_t y) {
+		for (uint32_t x = 0; x < get_width(); ++x)
+		{
+			uint32_t  sample_count = adaptive_.sample_count(x, y);
+			glm::vec3 color        = sample_count > 0 ? get_pixel_accumulation(x, y) / static_cast<float>(sample_count) : glm::vec3{0.0f};
+			if (noise_heatmap_)
+			{
+				color = glm::mix(color, heatmap_color(adaptive_.tile_error(x, y) / threshold), 0.5f);
+			}
+			set_pixel(x, y, color);
+		}
+	});
+	display_dirty_ = false;
+}
+
+Sampler Renderer::pixel_sampler(uint32_t x, uint32_t y) const
+{
+	Sampler sampler(sampler_type_, sample_per_pixel_);
+	sampler.start_pixel_sample(x, y, adaptive_.sample_count(x, y));
+	return sampler;
+}
+
+void Renderer::render_pixel(uint32_t x, uint32_t y, const glm::vec3 &color)
+{
+	// Pixels only have the same sample count as long as every frame renders all of them
+	get_pixel_accumulation(x, y) += color;
+	adaptive_.add_sample(x, y, color);
+	glm::vec3 accumulated_color = get_pixel_accumulation(x, y);
+	accumulated_color /= static_cast<float>(adaptive_.sample_count(x, y));
+
+	set_pixel(x, y, accumulated_color);
+	++pixels_rendered;
+}
+
+void Renderer::render_tile(uint32_t tile_x, uint32_t tile_y)
+{
+	uint32_t x0 = tile_x * RAY_PACKET_TILE;
+	uint32_t y0 = tile_y * RAY_PACKET_TILE;
+	uint32_t x1 = std::min(x0 + RAY_PACKET_TILE, get_width());
+	uint32_t y1 = std::min(y0 + RAY_PACKET_TILE, get_height());
+
+	// Every lane keeps the sampler of its pixel for shading, so a pixel gets the same samples whether
+	// it is traced in a packet or on its own
+	RayPacket packet;
+	Sampler   samplers[RAY_PACKET_SIZE];
+	for (uint32_t y = y0; y < y1; ++y)
+	{
+		for (uint32_t x = x0; x < x1; ++x)
+		{
+			samplers[packet.size] = pixel_sampler(x, y);
+			packet.add(camera_->get_ray(x, y, samplers[packet.size]));
+		}
+	}
+	packet.compute_bounds();
+
+	HitRecord records[RAY_PACKET_SIZE];
+	LaneMask  hits = scene_->top_level().hit_packet(packet, packet.all_lanes(), records);
+
+	uint32_t lane = 0;
+	for (uint32_t y = y0; y < y1; ++y)
+	{
+		for (uint32_t x = x0; x < x1; ++x, ++lane)
+		{
+			glm::vec3 color{0, 0, 0};
+			if (max_depth_ > 0 && (hits & (LaneMask{1} << lane)))
+			{
+				color = shade(packet.rays[lane], records[lane], max_depth_, samplers[lane]);
+			}
+			else if (max_depth_ > 0)
+			{
+				color = escaped_radiance(packet.rays[lane], true, 0.0f, nullptr);
+			}
+			render_pixel(x, y, color);
+		}
+	}
+}
 
+glm::vec3 Renderer::ray_color(const Ray &r, int depth, Sampler &sampler) const
+{
 	if (depth <= 0)
 		return glm::vec3{0, 0, 0};
 
 	HitRecord rec;
 
-	if (!scene_->world().hit(r, Interval(0.001f), rec))
+	if (!scene_->top_level().hit(r, Interval(0.001f), rec))
+	{
+		return escaped_radiance(r, true, 0.0f, nullptr);
+	}
+
+	return shade(r, rec, depth, sampler);
+}
+
+glm::vec3 Renderer::shade(const Ray &r, const HitRecord &rec, int depth, Sampler &sampler) const
+{
+	if (scene_->lights().empty() && !scene_->environment())
 	{
+		LOGE("No light in the scene");
 		return glm::vec3{0, 0, 0};
 	}
 
-	//return glm::vec3{1, 0, 0};
-	ScatterRecord scatter_record;
-	glm::vec3     color_from_emission = rec.material->emitted(rec.u, rec.v, rec.position);
+	return trace_path(r, rec, depth, sampler);
+}
+
+glm::vec3 Renderer::trace_path(Ray ray, HitRecord rec, int depth, Sampler &sampler, const ScatterRecord *first_scatter, PathBranch *branch) const
+{
+	const auto *lights = scene_->light_sampler(light_sampler_type_);
+
+	// Guided sampling starts once an iteration was learned, recording starts right away
+	PathGuide       *training = path_guiding_ ? path_guide_.get() : nullptr;
+	const PathGuide *guide    = training && training->is_trained() ? training : nullptr;
+
+	// Incident radiance found through every recorded vertex, relative to the throughput past it. Emission
+	// is learned with its MIS weight, the guide does not need to find what light sampling already finds
+	struct GuidedVertex
+	{
+		uint32_t  leaf;
+		glm::vec3 direction;
+		glm::vec3 inverse_throughput;
+		glm::vec3 radiance;
+		float     pdf;
+	};
+	GuidedVertex guided_vertices[GUIDING_MAX_VERTICES];
+	int          guided_count = 0;
+
+	// Radiance reflected by every diffuse vertex of a training path, relative to the throughput reaching it.
+	// Training paths teach the cache and never end in it, the others only look it up
+	RadianceCache *cache          = radiance_caching_ ? radiance_cache_.get() : nullptr;
+	bool           cache_training = branch ? branch->cache_training : cache && sampler.get_1d() < RADIANCE_CACHE_TRAINING_FRACTION;
+	float          cell_footprint = RADIANCE_CACHE_CELL_PIXELS * camera_->pixel_spread();        // per unit of distance from the camera
+	struct CachedVertex
+	{
+		uint32_t  cell;
+		glm::vec3 inverse_throughput;
+		glm::vec3 radiance;
+	};
+	CachedVertex cached_vertices[RADIANCE_CACHE_MAX_VERTICES];
+	int          cached_count    = 0;
+	int          diffuse_bounces = branch ? branch->diffuse_bounces : 0;
+
+	// Throughput is weighed against the pixel's estimate, primary sample space paths have no pixel of their
+	// own and keep the classic roulette
+	RouletteSplitting *splitting    = roulette_splitting_ && sampler.type() != SamplerType::kPrimarySample ? splitting_.get() : nullptr;
+	float              pixel_weight = splitting ? 1.0f / adaptive_.mean_luminance(sampler.pixel_x(), sampler.pixel_y()) : 0.0f;
+	float              branching    = branch ? branch->branching : 1.0f;
+
+	// Radiance reflected by every non-specular vertex relative to the throughput past its splitting, and
+	// the rays traced before it, to learn what continuing from the vertex brings and costs
+	struct SplitVertex
+	{
+		uint32_t  cell;
+		glm::vec3 inverse_throughput;
+		glm::vec3 radiance;
+		uint32_t  rays;
+	};
+	SplitVertex split_vertices[ROULETTE_SPLITTING_MAX_VERTICES];
+	int         split_count = 0;
+	uint32_t    rays        = 0;
+
+	glm::vec3 radiance{0.0f};
+	glm::vec3 throughput{1.0f};
+
+	auto add_radiance = [&](const glm::vec3 &contribution) {
+		radiance += contribution;
+		for (int i = 0; i < guided_count; ++i)
+		{
+			guided_vertices[i].radiance += contribution * guided_vertices[i].inverse_throughput;
+		}
+		for (int i = 0; i < cached_count; ++i)
+		{
+			cached_vertices[i].radiance += contribution * cached_vertices[i].inverse_throughput;
+		}
+		for (int i = 0; i < split_count; ++i)
+		{
+			split_vertices[i].radiance += contribution * split_vertices[i].inverse_throughput;
+		}
+	};
+
+	// State of the previous vertex, needed to weight emission found by its BSDF sample
+	bool      specular_bounce = true;
+	bool      count_emission  = first_scatter == nullptr && branch == nullptr;
+	float     bsdf_pdf        = 0.0f;
+	glm::vec3 previous_position{0.0f};
+
+	for (int vertex = 0; vertex < depth; ++vertex)
+	{
+		bool direct_estimated = vertex == 0 && first_scatter;
+		bool branch_start     = vertex == 0 && branch;
+		bool rouletted        = false;
+		if (count_emission)
+		{
+			glm::vec3 emitted = rec.material->emitted(rec.u, rec.v, rec.position);
+			if (emitted != glm::vec3{0.0f})
+			{
+				float weight = 1.0f;
+				if (!specular_bounce && lights)
+				{
+					weight = power_heuristic(bsdf_pdf, lights->pdf_value(previous_position, rec));
+				}
+				add_radiance(throughput * emitted * weight);
+			}
+		}
+		count_emission = !direct_estimated;
+
+		ScatterRecord scatter_record;
+		if (direct_estimated)
+		{
+			scatter_record = *first_scatter;
+		}
+		else if (!rec.material->scatter(ray, rec, scatter_record, sampler))
+		{
+			break;
+		}
+
+		if (scatter_record.skip_pdf)
+		{
+			throughput *= scatter_record.attenuation;
+			ray             = scatter_record.skip_pdf_ray;
+			specular_bounce = true;
+		}
+		else
+		{
+			// Everything the vertex reflects comes from the cache, emission found by the previous BSDF sample was already added.
+			// Only diffuse vertices are cached, what glossy ones reflect depends on the view direction the cache does not key on
+			bool diffuse = rec.material->is_diffuse();
+			if (cache && diffuse && !direct_estimated && !branch_start)
+			{
+				float     footprint = cell_footprint * glm::length(rec.position - camera_->position());
+				glm::vec3 cached;
+				if (!cache_training && diffuse_bounces >= radiance_cache_bounces_ && cache->lookup(rec.position, rec.normal, footprint, cached))
+				{
+					add_radiance(throughput * cached);
+					break;
+				}
+
+				uint32_t cell = cache_training && cached_count < RADIANCE_CACHE_MAX_VERTICES ? cache->insert(rec.position, rec.normal, footprint) : UINT32_MAX;
+				if (cell != UINT32_MAX)
+				{
+					cached_vertices[cached_count++] = {cell, safe_inverse(throughput), glm::vec3{0.0f}};
+				}
+			}
+
+			uint32_t leaf        = training ? training->leaf(rec.position, rec.normal) : 0;
+			auto     sampled_pdf = [&](const glm::vec3 &direction) {
+				float pdf = scatter_record.pdf.value(direction);
+				return guide ? glm::mix(pdf, guide->pdf(leaf, direction), GUIDING_FRACTION) : pdf;
+			};
+
+			// The vertex continues as n branches with n = q on average and each carrying 1 / q of the throughput,
+			// the path ends when n is 0 and the extra branches are traced right away
+			if (splitting && !direct_estimated && !branch_start)
+			{
+				uint32_t cell = splitting->cell(rec.position, rec.normal);
+				float    factor;
+				if (splitting->splitting_factor(cell, rgb_to_luminance(throughput) * pixel_weight, factor))
+				{
+					// Splits multiply along the path, their product is bounded so that no path grows into a tree
+					factor = std::min(factor, std::max(ROULETTE_SPLITTING_MAX_BRANCHES / branching, 1.0f));
+					branching *= std::max(factor, 1.0f);
+					rouletted = true;
+
+					int branches = static_cast<int>(factor);
+					if (sampler.get_1d() < factor - static_cast<float>(branches))
+					{
+						++branches;
+					}
+					if (branches == 0)
+					{
+						break;
+					}
+
+					throughput /= factor;
+					for (int i = 1; i < branches; ++i)
+					{
+						PathBranch split{diffuse_bounces, cache_training, branching, 0};
+						glm::vec3  reflected = trace_path(ray, rec, depth - vertex, sampler, nullptr, &split);
+						add_radiance(throughput * reflected);
+						splitting->record(cell, rgb_to_luminance(reflected), split.ray_count);
+						rays += split.ray_count;
+					}
+				}
+				if (split_count < ROULETTE_SPLITTING_MAX_VERTICES)
+				{
+					split_vertices[split_count++] = {cell, safe_inverse(throughput), glm::vec3{0.0f}, rays};
+				}
+			}
+
+			// Light sample with a shadow ray, unless the direct light of the first vertex is estimated by the caller
+			LightSample light_sample;
+			if (lights && !direct_estimated && lights->sample(rec.position, sampler, light_sample))
+			{
+				Ray shadow_ray(rec.position, light_sample.position - rec.position);
+				++rays;
+				if (!scene_->top_level().occluded(shadow_ray, Interval(0.001f, 0.999f)))
+				{
+					float scattering_pdf = rec.material->scattering_pdf(ray, rec, shadow_ray);
+					float light_bsdf_pdf = sampled_pdf(shadow_ray.direction());
+					float weight         = power_heuristic(light_sample.pdf, light_bsdf_pdf);
+					add_radiance(throughput * scatter_record.attenuation * scattering_pdf * light_sample.radiance * weight / light_sample.pdf);
+				}
+			}
+
+			// One-sample MIS between the BSDF and the guide, bsdf_pdf is the density of the mixture
+			glm::vec3 direction = guide && sampler.get_1d() < GUIDING_FRACTION ? guide->sample(leaf, sampler.get_2d()) : scatter_record.pdf.generate(sampler);
+			Ray       scattered(rec.position, direction);
+			bsdf_pdf = sampled_pdf(scattered.direction());
+			if (bsdf_pdf <= 0.0f)
+			{
+				break;
+			}
+
+			throughput *= scatter_record.attenuation * rec.material->scattering_pdf(ray, rec, scattered) / bsdf_pdf;
+			previous_position = rec.position;
+			specular_bounce   = false;
+			ray               = scattered;
+			if (diffuse)
+			{
+				++diffuse_bounces;
+			}
+
+			if (training && !direct_estimated && guided_count < GUIDING_MAX_VERTICES)
+			{
+				guided_vertices[guided_count++] = {leaf, scattered.direction(), safe_inverse(throughput), glm::vec3{0.0f}, bsdf_pdf};
+			}
+		}
+
+		if (vertex + 1 >= depth)
+		{
+			break;
+		}
 
-	//return rec.material->debug_color(rec.u, rec.v, rec.position);
+		// Russian roulette on the accumulated throughput, only once a few bounces have been gathered
+		float max_throughput = std::max(throughput.x, std::max(throughput.y, throughput.z));
+		if (!rouletted && vertex >= RUSSIAN_ROULETTE_DEPTH && max_throughput < 1.0f)
+		{
+			float continue_probability = std::max(max_throughput, 0.05f);
+			if (sampler.get_1d() >= continue_probability)
+			{
+				break;
+			}
+			throughput /= continue_probability;
+		}
+		if (max_throughput <= 0.0f)
+		{
+			break;
+		}
+		++rays;
+		if (!scene_->top_level().hit(ray, Interval(0.001f), rec))
+		{
+			if (count_emission)
+			{
+				add_radiance(throughput * escaped_radiance(ray, specular_bounce, bsdf_pdf, lights));
+			}
+			break;
+		}
+	}
 
-	if (scene_->lights().empty())
+	for (int i = 0; i < guided_count; ++i)
+	{
+		const auto &guided = guided_vertices[i];
+		training->record(guided.leaf, guided.direction, rgb_to_luminance(guided.radiance) / guided.pdf);
+	}
+	for (int i = 0; i < cached_count; ++i)
+	{
+		cache->add_sample(cached_vertices[i].cell, cached_vertices[i].radiance);
+	}
+	for (int i = 0; i < split_count; ++i)
+	{
+		const auto &split = split_vertices[i];
+		splitting->record(split.cell, rgb_to_luminance(split.radiance), rays - split.rays);
+	}
+
+	// The camera ray is part of the path's cost, branches add their rays to the path they split from
+	if (branch)
+	{
+		branch->ray_count = rays;
+	}
+	else if (splitting)
+	{
+		splitting->add_path(rays + 1);
+	}
+	return radiance;
+}
+
+glm::vec3 Renderer::escaped_radiance(const Ray &ray, bool specular_bounce, float bsdf_pdf, const LightSampler *lights) const
+{
+	const EnvironmentLight *environment = scene_->environment();
+	if (!environment)
+	{
+		return glm::vec3{0.0f};
+	}
+
+	float weight = 1.0f;
+	if (!specular_bounce && lights)
+	{
+		weight = power_heuristic(bsdf_pdf, lights->environment_pdf(ray.direction()));
+	}
+	return environment->radiance(ray.direction()) * weight;
+}
+
+void Renderer::render_wavefront()
+{
+	auto  &paths = wavefront_;
+	auto  &queue = paths.path_queue;
+	size_t count = static_cast<size_t>(get_width()) * get_height();
+	paths.resize(count);
+
+	queue.resize(count);
+	std::iota(queue.begin(), queue.end(), 0u);
+	std::for_each(std::execution::par, queue.begin(), queue.end(), [this](uint32_t path) {
+		wavefront_generate(path);
+	});
+
+	if (scene_->lights().empty() && !scene_->environment())
 	{
 		LOGE("No light in the scene");
-		return glm::vec3{0, 0, 0};
+		queue.clear();
 	}
 
-	if (!rec.material->scatter(r, rec, scatter_record))
-		return color_from_emission;
+	// Removing finished paths keeps the order of the others
+	auto compact = [&paths, &queue]() {
+		queue.erase(std::remove_if(std::execution::par, queue.begin(), queue.end(), [&paths](uint32_t path) { return !paths.alive[path]; }), queue.end());
+	};
 
-	if (scatter_record.skip_pdf)
+	const auto *lights = scene_->light_sampler(light_sampler_type_);
+	for (int vertex = 0; vertex < max_depth_ && !queue.empty(); ++vertex)
 	{
-		return scatter_record.attenuation * ray_color(scatter_record.skip_pdf_ray, depth - 1);
+		std::for_each(std::execution::par, queue.begin(), queue.end(), [this, &paths, lights](uint32_t path) {
+			paths.alive[path] = scene_->top_level().hit(paths.rays[path], Interval(0.001f), paths.records[path]);
+			if (!paths.alive[path])
+			{
+				paths.radiances[path] += paths.throughputs[path] * escaped_radiance(paths.rays[path], paths.specular_bounces[path], paths.bsdf_pdfs[path], lights);
+			}
+		});
+		compact();
+
+		// Paths on the same material are shaded one after the other, pixel order is kept within a material
+		std::sort(std::execution::par, queue.begin(), queue.end(), [&paths](uint32_t a, uint32_t b) {
+			const Material *material_a = paths.records[a].material.get();
+			const Material *material_b = paths.records[b].material.get();
+			return material_a != material_b ? std::less<const Material *>()(material_a, material_b) : a < b;
+		});
+
+		std::for_each(std::execution::par, queue.begin(), queue.end(), [this, vertex, lights](uint32_t path) {
+			wavefront_shade(path, vertex, lights);
+		});
+
+		auto &shadow_queue = paths.shadow_queue;
+		shadow_queue.resize(queue.size());
+		shadow_queue.erase(std::copy_if(std::execution::par, queue.begin(), queue.end(), shadow_queue.begin(), [&paths](uint32_t path) { return paths.has_shadow_ray[path]; }),
+		                   shadow_queue.end());
+		std::for_each(std::execution::par, shadow_queue.begin(), shadow_queue.end(), [this, &paths](uint32_t path) {
+			if (!scene_->top_level().occluded(paths.shadow_rays[path], Interval(0.001f, 0.999f)))
+			{
+				paths.radiances[path] += paths.shadow_contributions[path];
+			}
+		});
+		compact();
 	}
 
-	auto       light = std::make_shared<HittablePdf>(scene_->lights(), rec.position);
-	MixturePdf p(light, scatter_record.pdf);
-	Ray  scattered = Ray(rec.position, p.generate());
-	auto pdf_val   = p.value(scattered.direction());
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this](uint32_t y) {
+		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, y](uint32_t x) {
+			render_pixel(x, y, wavefront_.radiances[static_cast<size_t>(y) * get_width() + x]);
+		});
+	});
+}
+
+void Renderer::wavefront_generate(uint32_t path)
+{
+	auto    &paths = wavefront_;
+	uint32_t x     = path % get_width();
+	uint32_t y     = path / get_width();
+
+	paths.samplers[path]           = pixel_sampler(x, y);
+	paths.rays[path]               = camera_->get_ray(x, y, paths.samplers[path]);
+	paths.throughputs[path]        = glm::vec3{1.0f};
+	paths.radiances[path]          = glm::vec3{0.0f};
+	paths.previous_positions[path] = glm::vec3{0.0f};
+	paths.bsdf_pdfs[path]          = 0.0f;
+	paths.specular_bounces[path]   = true;
+	paths.has_shadow_ray[path]     = false;
+}
+
+void Renderer::wavefront_shade(uint32_t path, int vertex, const LightSampler *lights)
+{
+	auto            &paths      = wavefront_;
+	const HitRecord &rec        = paths.records[path];
+	const Ray       &ray        = paths.rays[path];
+	Sampler         &sampler    = paths.samplers[path];
+	glm::vec3       &throughput = paths.throughputs[path];
 
-	//Ray  scattered = Ray(rec.position, scatter_record.pdf->generate());
-	//auto pdf_val   = scatter_record.pdf->value(scattered.direction());
+	paths.has_shadow_ray[path] = false;
+	paths.alive[path]          = false;
 
-	float scattering_pdf = rec.material->scattering_pdf(r, rec, scattered);
+	glm::vec3 emitted = rec.material->emitted(rec.u, rec.v, rec.position);
+	if (emitted != glm::vec3{0.0f})
+	{
+		float weight = 1.0f;
+		if (!paths.specular_bounces[path] && lights)
+		{
+			weight = power_heuristic(paths.bsdf_pdfs[path], lights->pdf_value(paths.previous_positions[path], rec));
+		}
+		paths.radiances[path] += throughput * emitted * weight;
+	}
+
+	ScatterRecord scatter_record;
+	if (!rec.material->scatter(ray, rec, scatter_record, sampler))
+	{
+		return;
+	}
 
-	 // Russian Roulette
-	float continue_probability = std::max(scatter_record.attenuation.x, std::max(scatter_record.attenuation.y, scatter_record.attenuation.z));
-	if (random_float() < continue_probability)
+	Ray next_ray;
+	if (scatter_record.skip_pdf)
 	{
-		glm::vec3 sample_color       = ray_color(scattered, depth - 1);
-		glm::vec3 color_from_scatter = scatter_record.attenuation * scattering_pdf * sample_color / pdf_val / continue_probability;
-		return color_from_emission + color_from_scatter;
+		throughput *= scatter_record.attenuation;
+		next_ray                     = scatter_record.skip_pdf_ray;
+		paths.specular_bounces[path] = true;
 	}
 	else
 	{
-		return color_from_emission;
+		// The shadow ray is traced by the next stage, the contribution is known up to its visibility
+		LightSample light_sample;
+		if (lights && lights->sample(rec.position, sampler, light_sample))
+		{
+			Ray   shadow_ray(rec.position, light_sample.position - rec.position);
+			float scattering_pdf = rec.material->scattering_pdf(ray, rec, shadow_ray);
+			float light_bsdf_pdf = scatter_record.pdf.value(shadow_ray.direction());
+			float weight         = power_heuristic(light_sample.pdf, light_bsdf_pdf);
+
+			paths.shadow_rays[path]          = shadow_ray;
+			paths.shadow_contributions[path] = throughput * scatter_record.attenuation * scattering_pdf * light_sample.radiance * weight / light_sample.pdf;
+			paths.has_shadow_ray[path]       = true;
+		}
+
+		Ray   scattered(rec.position, scatter_record.pdf.generate(sampler));
+		float bsdf_pdf = scatter_record.pdf.value(scattered.direction());
+		if (bsdf_pdf <= 0.0f)
+		{
+			return;
+		}
+
+		throughput *= scatter_record.attenuation * rec.material->scattering_pdf(ray, rec, scattered) / bsdf_pdf;
+		paths.bsdf_pdfs[path]          = bsdf_pdf;
+		paths.previous_positions[path] = rec.position;
+		paths.specular_bounces[path]   = false;
+		next_ray                       = scattered;
+	}
+
+	if (vertex + 1 >= max_depth_)
+	{
+		return;
+	}
+
+	// Same roulette as trace_path, so both integrators converge to the same image
+	float max_throughput = std::max(throughput.x, std::max(throughput.y, throughput.z));
+	if (vertex >= RUSSIAN_ROULETTE_DEPTH && max_throughput < 1.0f)
+	{
+		float continue_probability = std::max(max_throughput, 0.05f);
+		if (sampler.get_1d() >= continue_probability)
+		{
+			return;
+		}
+		throughput /= continue_probability;
+	}
+
+	paths.rays[path]  = next_ray;
+	paths.alive[path] = max_throughput > 0.0f;
+}
+
+void Renderer::render_restir()
+{
+	size_t pixel_count = static_cast<size_t>(get_width()) * get_height();
+	if (restir_surfaces_.size() != pixel_count)
+	{
+		restir_surfaces_.assign(pixel_count, {});
+		restir_history_.assign(pixel_count, {});
 	}
 
-	glm::vec3 sample_color       = ray_color(scattered, depth - 1);
-	glm::vec3 color_from_scatter = scatter_record.attenuation * scattering_pdf * sample_color / pdf_val;
+	// Spatial reuse reads the reservoirs of neighbouring pixels, so every initial reservoir has to be
+	// finished before the second pass starts
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this](uint32_t y) {
+		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, y](uint32_t x) {
+			restir_initial_samples(x, y);
+		});
+	});
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this](uint32_t y) {
+		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, y](uint32_t x) {
+			restir_shade(x, y);
+		});
+	});
+}
+
+void Renderer::restir_initial_samples(uint32_t x, uint32_t y)
+{
+	auto  index   = static_cast<size_t>(y) * get_width() + x;
+	auto &surface = restir_surfaces_[index];
+	surface       = {};
 
-	return color_from_emission + color_from_scatter;
+	Sampler       sampler = pixel_sampler(x, y);
+	Ray           ray;
+	HitRecord     rec;
+	ScatterRecord scatter_record;
+	if (!restir_primary_hit(x, y, sampler, ray, rec, scatter_record))
+	{
+		return;
+	}
+
+	// Candidates only cost an O(1) alias table pick and a target evaluation, no ray is traced for them
+	const auto *lights     = scene_->light_sampler(LightSamplerType::kPower);
+	Sampler     candidates = restir_sampler(x, y, 0);
+	Reservoir   reservoir;
+	for (int i = 0; i < RESTIR_CANDIDATES; ++i)
+	{
+		LightSample  light_sample;
+		RestirSample candidate{};
+		float        target = 0.0f;
+		float        weight = 0.0f;
+		if (lights->sample(rec.position, candidates, light_sample))
+		{
+			candidate = {light_sample.position, light_sample.normal, light_sample.radiance};
+			target    = rgb_to_luminance(restir_contribution(ray, rec, scatter_record, candidate));
+
+			// Reservoirs live in area measure so they stay valid at other shading points
+			glm::vec3 to_light         = light_sample.position - rec.position;
+			float     distance_squared = glm::dot(to_light, to_light);
+			float     area_pdf         = light_sample.pdf * std::fabs(glm::dot(light_sample.normal, to_light)) / (distance_squared * std::sqrt(distance_squared));
+			weight                     = area_pdf > 0.0f ? target / area_pdf : 0.0f;
+		}
+		reservoir.update(candidate, weight, target, candidates.get_1d());
+	}
+	reservoir.finalize();
+
+	// Temporal reuse while the camera stands still, the history is capped so the image keeps adapting
+	const auto &previous = restir_history_[index];
+	if (frame_index_ > 1 && previous.valid && is_similar_surface(previous, rec))
+	{
+		Reservoir history = previous.reservoir;
+		history.count     = std::min(history.count, RESTIR_HISTORY_LIMIT * RESTIR_CANDIDATES);
+		reservoir.merge(history, rgb_to_luminance(restir_contribution(ray, rec, scatter_record, history.sample)), candidates.get_1d());
+		reservoir.finalize();
+	}
+
+	surface = {reservoir, rec.position, rec.normal, rec.t, true};
+}
+
+void Renderer::restir_shade(uint32_t x, uint32_t y)
+{
+	auto        index   = static_cast<size_t>(y) * get_width() + x;
+	const auto &surface = restir_surfaces_[index];
+
+	// The pixel sampler replays the primary hit of the first pass
+	Sampler sampler = pixel_sampler(x, y);
+	if (!surface.valid)
+	{
+		Ray ray = camera_->get_ray(x, y, sampler);
+		render_pixel(x, y, ray_color(ray, max_depth_, sampler));
+		restir_history_[index].valid = false;
+		return;
+	}
+
+	Ray           ray;
+	HitRecord     rec;
+	ScatterRecord scatter_record;
+	restir_primary_hit(x, y, sampler, ray, rec, scatter_record);
+
+	// Spatial reuse from random pixels in a disk around this one
+	Sampler   reuse     = restir_sampler(x, y, 1);
+	Reservoir reservoir = surface.reservoir;
+	for (int i = 0; i < RESTIR_SPATIAL_NEIGHBORS; ++i)
+	{
+		glm::vec2 u          = reuse.get_2d();
+		float     radius     = RESTIR_SPATIAL_RADIUS * std::sqrt(u.x);
+		float     phi        = 2.0f * glm::pi<float>() * u.y;
+		int       neighbor_x = static_cast<int>(x) + static_cast<int>(radius * std::cos(phi));
+		int       neighbor_y = static_cast<int>(y) + static_cast<int>(radius * std::sin(phi));
+		if (neighbor_x < 0 || neighbor_y < 0 || neighbor_x >= static_cast<int>(get_width()) || neighbor_y >= static_cast<int>(get_height()) ||
+		    (neighbor_x == static_cast<int>(x) && neighbor_y == static_cast<int>(y)))
+		{
+			continue;
+		}
+
+		const auto &neighbor = restir_surfaces_[static_cast<size_t>(neighbor_y) * get_width() + neighbor_x];
+		if (!neighbor.valid || !is_similar_surface(neighbor, rec))
+		{
+			continue;
+		}
+		reservoir.merge(neighbor.reservoir, rgb_to_luminance(restir_contribution(ray, rec, scatter_record, neighbor.reservoir.sample)), reuse.get_1d());
+	}
+	reservoir.finalize();
+
+	// The next frame reuses the reservoir from before spatial reuse, so samples do not spread further every frame
+	restir_history_[index] = surface;
+
+	// The only shadow ray of the pixel's direct light
+	glm::vec3 color = rec.material->emitted(rec.u, rec.v, rec.position);
+	if (reservoir.contribution_weight > 0.0f)
+	{
+		Ray shadow_ray(rec.position, reservoir.sample.position - rec.position);
+		if (!scene_->top_level().occluded(shadow_ray, Interval(0.001f, 0.999f)))
+		{
+			color += restir_contribution(ray, rec, scatter_record, reservoir.sample) * reservoir.contribution_weight;
+		}
+	}
+
+	color += trace_path(ray, rec, max_depth_, sampler, &scatter_record);
+	render_pixel(x, y, color);
+}
+
+bool Renderer::restir_primary_hit(uint32_t x, uint32_t y, Sampler &sampler, Ray &ray, HitRecord &rec, ScatterRecord &scatter_record) const
+{
+	ray = camera_->get_ray(x, y, sampler);
+	if (!scene_->top_level().hit(ray, Interval(0.001f), rec))
+	{
+		return false;
+	}
+
+	// Specular surfaces keep the path tracer, light samples cannot reach them
+	if (!rec.material->scatter(ray, rec, scatter_record, sampler) || scatter_record.skip_pdf)
+	{
+		return false;
+	}
+	return scene_->light_sampler(LightSamplerType::kPower) != nullptr;
+}
+
+glm::vec3 Renderer::restir_contribution(const Ray &r, const HitRecord &rec, const ScatterRecord &scatter_record, const RestirSample &sample) const
+{
+	glm::vec3 to_light         = sample.position - rec.position;
+	float     distance_squared = glm::dot(to_light, to_light);
+	if (distance_squared <= 0.0f)
+	{
+		return glm::vec3{0.0f};
+	}
+
+	float cos_light      = std::fabs(glm::dot(sample.normal, to_light)) / std::sqrt(distance_squared);
+	float scattering_pdf = rec.material->scattering_pdf(r, rec, Ray(rec.position, to_light));
+	return scatter_record.attenuation * scattering_pdf * sample.radiance * cos_light / distance_squared;
+}
+
+Sampler Renderer::restir_sampler(uint32_t x, uint32_t y, uint32_t pass) const
+{
+	Sampler sampler(SamplerType::kIndependent, 1, RESTIR_SEED + pass);
+	sampler.start_pixel_sample(x, y, frame_index_ - 1);
+	return sampler;
+}
+
+void Renderer::render_photon_mapping()
+{
+	if (frame_index_ == 1)
+	{
+		const Aabb &bounds = scene_->top_level().bounding_box();
+		photon_radius_     = photon_initial_radius_ > 0.0f ? photon_initial_radius_ : PHOTON_RADIUS_FRACTION * glm::length(bounds.max() - bounds.min());
+	}
+
+	// Photons start from emitters picked by power, wherever they are seen from, or from the environment
+	const auto *photon_lights = scene_->light_sampler(LightSamplerType::kPower);
+	uint32_t    photon_count  = photons_per_pass_ > 0 ? photons_per_pass_ : get_width() * get_height();
+	if (photon_buffers_.size() != PHOTON_BATCHES)
+	{
+		photon_buffers_.resize(PHOTON_BATCHES);
+		photon_batch_iter_.resize(PHOTON_BATCHES);
+		std::iota(photon_batch_iter_.begin(), photon_batch_iter_.end(), 0);
+	}
+	if (photon_lights)
+	{
+		std::for_each(std::execution::par, photon_batch_iter_.begin(), photon_batch_iter_.end(), [this, photon_count, photon_lights](uint32_t batch) {
+			trace_photons(batch, photon_count, *photon_lights);
+		});
+	}
+	photon_map_.build(photon_buffers_, photon_radius_);
+
+	const auto *lights = scene_->light_sampler(light_sampler_type_);
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this, lights](uint32_t y) {
+		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, lights, y](uint32_t x) {
+			render_pixel(x, y, photon_mapping_color(x, y, lights));
+		});
+	});
+
+	// The radius of the next pass keeps PHOTON_RADIUS_ALPHA of the photons that would fall into this one
+	auto passes = static_cast<float>(frame_index_);
+	photon_radius_ *= std::sqrt((passes + PHOTON_RADIUS_ALPHA) / (passes + 1.0f));
+}
+
+void Renderer::render_bidirectional()
+{
+	uint32_t width  = get_width();
+	uint32_t height = get_height();
+	if (frame_index_ == 1 || bidirectional_radiance_.size() != static_cast<size_t>(width) * height)
+	{
+		splat_film_.resize(width, height);
+		bidirectional_radiance_.assign(static_cast<size_t>(width) * height, glm::vec3{0.0f});
+	}
+
+	// Light subpaths start from emitters picked by power, the same sampler serves the light samples of the connections
+	const auto *lights = scene_->light_sampler(LightSamplerType::kPower);
+	if (lights)
+	{
+		BidirectionalPathTracer tracer(scene_->top_level(), *camera_, *lights, max_depth_);
+		std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this, &tracer, width](uint32_t y) {
+			std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, &tracer, width, y](uint32_t x) {
+				Sampler sampler                          = pixel_sampler(x, y);
+				bidirectional_radiance_[y * width + x] = tracer.sample(x, y, sampler, splat_film_);
+			});
+		});
+	}
+
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this, width](uint32_t y) {
+		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, width, y](uint32_t x) {
+			render_pixel(x, y, bidirectional_radiance_[y * width + x] + splat_film_.sum(x, y));
+		});
+	});
+	splat_film_.clear();
+}
+
+void Renderer::render_metropolis()
+{
+	if (frame_index_ == 1)
+	{
+		splat_film_.resize(get_width(), get_height());
+		metropolis_bootstrap();
+	}
+
+	uint64_t mutations = static_cast<uint64_t>(get_width()) * get_height() * metropolis_mutations_per_pixel_;
+	if (metropolis_normalization_ > 0.0f)
+	{
+		std::for_each(std::execution::par, metropolis_chain_iter_.begin(), metropolis_chain_iter_.end(), [this, mutations](uint32_t chain) {
+			metropolis_run_chain(chain, mutations);
+		});
+	}
+
+	// Splats are luminance-normalized, the mean luminance of a path brings them back to radiance. Emitters
+	// seen directly would take most of the chains' time in a small region, they get a camera ray per pixel
+	float scale = metropolis_normalization_ / static_cast<float>(metropolis_mutations_per_pixel_);
+	std::for_each(std::execution::par, image_vertical_iter_.begin(), image_vertical_iter_.end(), [this, scale](uint32_t y) {
+		std::for_each(std::execution::par, image_horizontal_iter_.begin(), image_horizontal_iter_.end(), [this, scale, y](uint32_t x) {
+			Sampler   sampler = pixel_sampler(x, y);
+			HitRecord rec;
+			Ray       ray = camera_->get_ray(x, y, sampler);
+			glm::vec3 emitted{0.0f};
+			if (scene_->top_level().hit(ray, Interval(0.001f), rec))
+			{
+				emitted = rec.material->emitted(rec.u, rec.v, rec.position);
+			}
+			else
+			{
+				emitted = escaped_radiance(ray, true, 0.0f, nullptr);
+			}
+			render_pixel(x, y, emitted + splat_film_.sum(x, y) * scale);
+		});
+	});
+	splat_film_.clear();
+}
+
+void Renderer::metropolis_bootstrap()
+{
+	std::vector<float>    luminances(METROPOLIS_BOOTSTRAP_SAMPLES);
+	std::vector<uint32_t> bootstrap_iter(METROPOLIS_BOOTSTRAP_SAMPLES);
+	std::iota(bootstrap_iter.begin(), bootstrap_iter.end(), 0);
+	std::for_each(std::execution::par, bootstrap_iter.begin(), bootstrap_iter.end(), [this, &luminances](uint32_t i) {
+		PrimarySampleSpace primary_sample(METROPOLIS_SEED, i, METROPOLIS_SIGMA, METROPOLIS_LARGE_STEP_PROBABILITY);
+		uint32_t           x         = 0;
+		uint32_t           y         = 0;
+		float              luminance = rgb_to_luminance(metropolis_sample(primary_sample, x, y));
+		luminances[i]                = std::isfinite(luminance) ? std::max(luminance, 0.0f) : 0.0f;
+	});
+
+	std::vector<double> cdf(METROPOLIS_BOOTSTRAP_SAMPLES);
+	std::partial_sum(luminances.begin(), luminances.end(), cdf.begin(), std::plus<double>());
+	metropolis_normalization_ = static_cast<float>(cdf.back() / METROPOLIS_BOOTSTRAP_SAMPLES);
+
+	metropolis_chains_.assign(METROPOLIS_CHAINS, MetropolisChain{});
+	metropolis_chain_iter_.resize(METROPOLIS_CHAINS);
+	std::iota(metropolis_chain_iter_.begin(), metropolis_chain_iter_.end(), 0);
+	if (metropolis_normalization_ <= 0.0f)
+	{
+		return;
+	}
+
+	// Chains start at bootstrap samples picked by luminance, so they are in equilibrium from the start
+	std::for_each(std::execution::par, metropolis_chain_iter_.begin(), metropolis_chain_iter_.end(), [this, &cdf](uint32_t chain) {
+		auto &state = metropolis_chains_[chain];
+		state.rng   = Rng(METROPOLIS_SEED ^ 0x5bd1e995u, chain);
+
+		double target = state.rng.next_float() * cdf.back();
+		auto   index  = static_cast<uint32_t>(std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin());
+		index         = std::min(index, METROPOLIS_BOOTSTRAP_SAMPLES - 1);
+
+		// Regenerates the bootstrap sample, then gives the chain mutations of its own in case another chain starts there too
+		state.primary_sample = PrimarySampleSpace(METROPOLIS_SEED, index, METROPOLIS_SIGMA, METROPOLIS_LARGE_STEP_PROBABILITY);
+		state.radiance       = metropolis_sample(state.primary_sample, state.x, state.y);
+		state.primary_sample.reseed(METROPOLIS_SEED, METROPOLIS_BOOTSTRAP_SAMPLES + static_cast<uint64_t>(chain));
+	});
+	LOGI("Metropolis: mean path luminance {} from {} bootstrap samples", metropolis_normalization_, METROPOLIS_BOOTSTRAP_SAMPLES)
+}
+
+void Renderer::metropolis_run_chain(uint32_t chain, uint64_t mutations)
+{
+	auto    &state = metropolis_chains_[chain];
+	uint64_t begin = mutations * chain / METROPOLIS_CHAINS;
+	uint64_t end   = mutations * (chain + 1) / METROPOLIS_CHAINS;
+
+	float current = rgb_to_luminance(state.radiance);
+	for (uint64_t mutation = begin; mutation < end; ++mutation)
+	{
+		state.primary_sample.start_iteration();
+		uint32_t  x          = 0;
+		uint32_t  y          = 0;
+		glm::vec3 radiance   = metropolis_sample(state.primary_sample, x, y);
+		float     proposed   = rgb_to_luminance(radiance);
+		if (!std::isfinite(proposed) || proposed < 0.0f)
+		{
+			proposed = 0.0f;
+		}
+
+		// Both the proposal and the current state are splatted with their expected weight, whichever is kept
+		float acceptance = current > 0.0f ? std::min(1.0f, proposed / current) : 1.0f;
+		if (proposed > 0.0f)
+		{
+			splat_film_.add(x, y, radiance * (acceptance / proposed));
+		}
+		if (current > 0.0f)
+		{
+			splat_film_.add(state.x, state.y, state.radiance * ((1.0f - acceptance) / current));
+		}
+
+		if (state.rng.next_float() < acceptance)
+		{
+			state.primary_sample.accept();
+			state.radiance = radiance;
+			state.x        = x;
+			state.y        = y;
+			current        = proposed;
+		}
+		else
+		{
+			state.primary_sample.reject();
+		}
+	}
+}
+
+glm::vec3 Renderer::metropolis_sample(PrimarySampleSpace &primary_sample, uint32_t &x, uint32_t &y) const
+{
+	Sampler   sampler(primary_sample);
+	glm::vec2 pixel = sampler.get_2d();
+	x               = std::min(static_cast<uint32_t>(pixel.x * static_cast<float>(get_width())), get_width() - 1);
+	y               = std::min(static_cast<uint32_t>(pixel.y * static_cast<float>(get_height())), get_height() - 1);
+
+	Ray       ray = camera_->get_ray(static_cast<float>(x), static_cast<float>(y), sampler);
+	HitRecord rec;
+	if (max_depth_ <= 0 || !scene_->top_level().hit(ray, Interval(0.001f), rec))
+	{
+		return glm::vec3{0.0f};
+	}
+
+	// The path tracer adds the emission of the first hit unweighted, render_metropolis() adds it per pixel instead
+	glm::vec3 radiance = shade(ray, rec, max_depth_, sampler) - rec.material->emitted(rec.u, rec.v, rec.position);
+	return glm::max(radiance, glm::vec3{0.0f});
+}
+
+void Renderer::trace_photons(uint32_t batch, uint32_t photon_count, const LightSampler &lights)
+{
+	auto    &buffer = photon_buffers_[batch];
+	uint32_t begin  = static_cast<uint32_t>(static_cast<uint64_t>(photon_count) * batch / PHOTON_BATCHES);
+	uint32_t end    = static_cast<uint32_t>(static_cast<uint64_t>(photon_count) * (batch + 1) / PHOTON_BATCHES);
+
+	for (uint32_t photon = begin; photon < end; ++photon)
+	{
+		Sampler sampler(SamplerType::kIndependent, 1, PHOTON_SEED);
+		sampler.start_pixel_sample(photon, 0, frame_index_ - 1);
+
+		// The environment sends the share of the photons that its light samples get
+		EmissionSample emission;
+		float          environment_probability = lights.environment_probability();
+		bool           from_environment        = environment_probability > 0.0f && sampler.get_1d() < environment_probability;
+		if (from_environment ? !lights.sample_environment_emission(sampler, emission) : !lights.sample_emission(sampler, emission))
+		{
+			continue;
+		}
+		float     pick  = from_environment ? environment_probability : 1.0f - environment_probability;
+		Ray       ray   = emission.ray;
+		glm::vec3 power = emission.radiance * glm::dot(emission.normal, ray.direction()) /
+		                  (emission.pdf_position * emission.pdf_direction * pick * static_cast<float>(photon_count));
+
+		glm::vec3 throughput{1.0f};
+		HitRecord rec;
+		for (int bounce = 0; bounce < max_depth_ && scene_->top_level().hit(ray, Interval(0.001f), rec); ++bounce)
+		{
+			ScatterRecord scatter_record;
+			if (!rec.material->scatter(ray, rec, scatter_record, sampler))
+			{
+				break;
+			}
+
+			if (scatter_record.skip_pdf)
+			{
+				throughput *= scatter_record.attenuation;
+				ray = scatter_record.skip_pdf_ray;
+			}
+			else
+			{
+				// Light that arrives without bouncing is sampled from the camera side
+				if (bounce > 0)
+				{
+					buffer.push_back({rec.position, ray.direction(), power * throughput});
+				}
+
+				Ray   scattered(rec.position, scatter_record.pdf.generate(sampler));
+				float pdf = scatter_record.pdf.value(scattered.direction());
+				if (pdf <= 0.0f)
+				{
+					break;
+				}
+				throughput *= scatter_record.attenuation * rec.material->scattering_pdf(ray, rec, scattered) / pdf;
+				ray = scattered;
+			}
+
+			float max_throughput = std::max(throughput.x, std::max(throughput.y, throughput.z));
+			if (bounce >= RUSSIAN_ROULETTE_DEPTH && max_throughput < 1.0f)
+			{
+				float continue_probability = std::max(max_throughput, 0.05f);
+				if (sampler.get_1d() >= continue_probability)
+				{
+					break;
+				}
+				throughput /= continue_probability;
+			}
+			if (max_throughput <= 0.0f)
+			{
+				break;
+			}
+		}
+	}
+}
+
+glm::vec3 Renderer::photon_mapping_color(uint32_t x, uint32_t y, const LightSampler *lights) const
+{
+	Sampler sampler = pixel_sampler(x, y);
+	Ray     ray     = camera_->get_ray(x, y, sampler);
+
+	glm::vec3 color{0.0f};
+	glm::vec3 throughput{1.0f};
+	HitRecord rec;
+	for (int vertex = 0; vertex < max_depth_; ++vertex)
+	{
+		// Only specular bounces get here, the environment behind them has no light sample to be weighted against
+		if (!scene_->top_level().hit(ray, Interval(0.001f), rec))
+		{
+			color += throughput * escaped_radiance(ray, true, 0.0f, nullptr);
+			break;
+		}
+		color += throughput * rec.material->emitted(rec.u, rec.v, rec.position);
+
+		ScatterRecord scatter_record;
+		if (!rec.material->scatter(ray, rec, scatter_record, sampler))
+		{
+			break;
+		}
+		if (scatter_record.skip_pdf)
+		{
+			throughput *= scatter_record.attenuation;
+			ray = scatter_record.skip_pdf_ray;
+			continue;
+		}
+
+		LightSample light_sample;
+		if (lights && lights->sample(rec.position, sampler, light_sample))
+		{
+			Ray shadow_ray(rec.position, light_sample.position - rec.position);
+			if (!scene_->top_level().occluded(shadow_ray, Interval(0.001f, 0.999f)))
+			{
+				float scattering_pdf = rec.material->scattering_pdf(ray, rec, shadow_ray);
+				color += throughput * scatter_record.attenuation * scattering_pdf * light_sample.radiance / light_sample.pdf;
+			}
+		}
+
+		// Density estimate of the reflected photon power, the BSDF is attenuation * scattering_pdf / cosine
+		glm::vec3 reflected{0.0f};
+		photon_map_.for_each_near(rec.position, [&](const Photon &photon) {
+			Ray   incident(rec.position, -photon.direction);
+			float cosine = glm::dot(rec.normal, glm::normalize(incident.direction()));
+			if (cosine > 0.0f)
+			{
+				reflected += photon.power * rec.material->scattering_pdf(ray, rec, incident) / cosine;
+			}
+		});
+		color += throughput * scatter_record.attenuation * reflected / (glm::pi<float>() * photon_radius_ * photon_radius_);
+		break;
+	}
+	return color;
 }
 }        // namespace mengze::rt
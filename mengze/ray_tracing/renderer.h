@@ -2,11 +2,33 @@
 
 #include "core/timer.h"
 #include "rendering/renderer.h"
+#include "ray_tracing/adaptive_sampling.h"
+#include "ray_tracing/bdpt.h"
 #include "ray_tracing/camera.h"
+#include "ray_tracing/metropolis.h"
+#include "ray_tracing/path_guiding.h"
+#include "ray_tracing/photon_map.h"
+#include "ray_tracing/radiance_cache.h"
+#include "ray_tracing/restir.h"
+#include "ray_tracing/roulette_splitting.h"
+#include "ray_tracing/sampler.h"
 #include "ray_tracing/scene.h"
+#include "ray_tracing/wavefront.h"
 
 namespace mengze::rt
 {
+enum class IntegratorType
+{
+	kPathTracer,
+	kRestirDi,         // direct light of primary hits resampled from many candidates, the rest path traced
+	kWavefront,        // same estimator as the path tracer, run one bounce of all pixels per stage
+	kPhotonMapping,    // progressive photon mapping, light sampled at the first diffuse hit and photons for the rest
+	kBidirectional,    // bidirectional path tracer, every camera vertex connected to every light vertex
+	kMetropolis,       // primary sample space Metropolis over the path tracer
+};
+
+const char *to_string(IntegratorType type);
+
 class Renderer : public mengze::Renderer
 {
   public:
@@ -22,7 +44,243 @@ class Renderer : public mengze::Renderer
 
 	void render() override;
 
-	glm::vec3 ray_color(const Ray &r, int depth) const;
+	glm::vec3 ray_color(const Ray &r, int depth, Sampler &sampler) const;
+
+	// Shading of a surface point that was already hit by r
+	glm::vec3 shade(const Ray &r, const HitRecord &rec, int depth, Sampler &sampler) const;
+
+	// Trace camera rays of 8x8 pixel blocks as packets, secondary rays are always traced one by one
+	void set_packet_tracing(bool enabled)
+	{
+		packet_tracing_ = enabled;
+	}
+
+	void set_sampler_type(SamplerType type)
+	{
+		sampler_type_ = type;
+		frame_index_  = 1;
+	}
+
+	void set_light_sampler_type(LightSamplerType type)
+	{
+		light_sampler_type_ = type;
+		frame_index_        = 1;
+	}
+
+	// Samples the picked emitter uniformly in the solid angle it subtends, see LightSampler::set_solid_angle_sampling()
+	void set_solid_angle_sampling(bool enabled)
+	{
+		solid_angle_sampling_ = enabled;
+		frame_index_          = 1;
+	}
+
+	void set_integrator(IntegratorType type)
+	{
+		integrator_  = type;
+		frame_index_ = 1;
+	}
+
+	/**
+	 * @brief Retires tiles whose pixels have converged and spends their share of the sample budget on the
+	 * noisy ones, a frame then only renders the active tiles. Only the path tracer samples adaptively.
+	 *
+	 * The budget stays sample_per_pixel samples per pixel, and no pixel takes more than
+	 * options.max_samples, or ADAPTIVE_MAX_SAMPLE_FACTOR times sample_per_pixel when that is 0.
+	 */
+	void set_adaptive_sampling(bool enabled, const AdaptiveSamplingOptions &options = {})
+	{
+		adaptive_sampling_ = enabled;
+		adaptive_options_  = options;
+		frame_index_       = 1;
+	}
+
+	// Blends the relative error of every tile over the image, green at the adaptive threshold
+	void set_noise_heatmap(bool enabled)
+	{
+		noise_heatmap_ = enabled;
+		display_dirty_ = true;
+	}
+
+	/**
+	 * @brief Mixes BSDF sampling with directions drawn from incident radiance learned on the fly. Frames
+	 * train in iterations of 1, 2, 4, ... frames and every iteration samples what the previous ones learned.
+	 * Applies to the path tracer and the paths continued by ReSTIR DI.
+	 */
+	void set_path_guiding(bool enabled)
+	{
+		path_guiding_ = enabled;
+		frame_index_  = 1;
+		if (enabled && !path_guide_)
+		{
+			path_guide_ = std::make_shared<PathGuide>();
+		}
+	}
+
+	/**
+	 * @brief Ends paths in a world-space cache of the radiance diffuse surfaces reflect once they bounced off
+	 * diffuse_bounces of them. A fraction of the paths is traced in full and writes the radiance it finds
+	 * into the cache. Cells outlive camera moves, the ones out of view age out. Applies to the path tracer
+	 * and the paths continued by ReSTIR DI, and trades some bias for speed.
+	 */
+	void set_radiance_cache(bool enabled, int diffuse_bounces = 1)
+	{
+		radiance_caching_       = enabled;
+		radiance_cache_bounces_ = diffuse_bounces;
+		frame_index_            = 1;
+		if (enabled && !radiance_cache_)
+		{
+			radiance_cache_ = std::make_shared<RadianceCache>();
+		}
+	}
+
+	/**
+	 * @brief Replaces Russian roulette with efficiency-aware roulette and splitting: the number of branches
+	 * a path continues with at a non-specular vertex follows what the region it reached contributes to the
+	 * image and what tracing from there costs, both learned while rendering. Classic roulette stays where
+	 * nothing was learned yet. Applies to the path tracer and the paths continued by ReSTIR DI.
+	 */
+	void set_roulette_splitting(bool enabled)
+	{
+		roulette_splitting_ = enabled;
+		frame_index_        = 1;
+		if (enabled && !splitting_)
+		{
+			splitting_ = std::make_shared<RouletteSplitting>();
+		}
+	}
+
+	/**
+	 * @brief Photons traced by every pass of the photon mapping integrator and the gather radius of the first
+	 * pass, which shrinks from pass to pass. 0 picks one photon per pixel and PHOTON_RADIUS_FRACTION of the
+	 * scene's diagonal.
+	 */
+	void set_photon_mapping(uint32_t photons_per_pass, float initial_radius = 0.0f)
+	{
+		photons_per_pass_      = photons_per_pass;
+		photon_initial_radius_ = initial_radius;
+		frame_index_           = 1;
+	}
+
+	// Mutations every pass of the Metropolis integrator makes, on average per pixel
+	void set_metropolis(uint32_t mutations_per_pixel)
+	{
+		metropolis_mutations_per_pixel_ = std::max(mutations_per_pixel, 1u);
+		frame_index_                    = 1;
+	}
+
+  private:
+	// Sampler positioned at the current sample of the pixel
+	Sampler pixel_sampler(uint32_t x, uint32_t y) const;
+
+	bool is_adaptive() const;
+
+	// True once the frame budget is spent, or with adaptive sampling the sample budget or every tile
+	bool is_finished() const;
+
+	AdaptiveSamplingOptions adaptive_options() const;
+
+	// Rewrites every displayed pixel from the accumulation, with the heatmap if it is enabled
+	void update_display();
+
+	void render_pixel(uint32_t x, uint32_t y, const glm::vec3 &color);
+
+	void render_tile(uint32_t tile_x, uint32_t tile_y);
+
+	// Path split at a vertex, continued by trace_path from there
+	struct PathBranch
+	{
+		int      diffuse_bounces;
+		bool     cache_training;
+		float    branching;        // product of the splitting factors above 1 on the way to the vertex
+		uint32_t ray_count;        // rays the branch traced, set by trace_path
+	};
+
+	/**
+	 * @brief Iterative path tracer from the hit rec of ray, with a light sample and a shadow ray at every
+	 * non-specular vertex combined with the BSDF sample by the power heuristic. With path guiding the
+	 * BSDF sample becomes a sample of the mixture of the BSDF and the guide, and the incident radiance
+	 * found at every vertex is recorded for training. With the radiance cache the path either teaches the
+	 * cache at every diffuse vertex, or ends in it at the first diffuse vertex past the set number of diffuse
+	 * bounces that has a cached value.
+	 *
+	 * With roulette and splitting a vertex may continue as several branches, the extra ones are traced by
+	 * recursive calls that get a branch: rec's emission was added by the caller, which also decided the
+	 * splitting at rec, and the branch learns how many rays it traced.
+	 *
+	 * When first_scatter is given, the direct light at rec was estimated by the caller: rec's emission,
+	 * its light sample and the emission found by its BSDF sample are left out, and first_scatter is used
+	 * instead of scattering at rec again.
+	 */
+	glm::vec3 trace_path(Ray ray, HitRecord rec, int depth, Sampler &sampler, const ScatterRecord *first_scatter = nullptr, PathBranch *branch = nullptr) const;
+
+	// Environment radiance of a ray that left the scene, weighted against the light sample of the vertex it left unless that was specular
+	glm::vec3 escaped_radiance(const Ray &ray, bool specular_bounce, float bsdf_pdf, const LightSampler *lights) const;
+
+	/**
+	 * @brief One wavefront frame: camera rays, then per bounce closest hits, compaction, sorting by
+	 * material, shading and shadow rays, each stage run over all live paths before the next one starts.
+	 */
+	void render_wavefront();
+
+	void wavefront_generate(uint32_t path);
+
+	// Emission, light sample and continuation ray of the vertex the path is at, clears alive when it ends
+	void wavefront_shade(uint32_t path, int vertex, const LightSampler *lights);
+
+	// One ReSTIR DI frame: initial candidates with temporal reuse, then spatial reuse and shading
+	void render_restir();
+
+	void restir_initial_samples(uint32_t x, uint32_t y);
+
+	void restir_shade(uint32_t x, uint32_t y);
+
+	// Traces the primary ray of the pixel's current sample, true if the direct light of its hit is resampled
+	bool restir_primary_hit(uint32_t x, uint32_t y, Sampler &sampler, Ray &ray, HitRecord &rec, ScatterRecord &scatter_record) const;
+
+	// Unshadowed contribution of a point on an emitter, its luminance is the target function
+	glm::vec3 restir_contribution(const Ray &r, const HitRecord &rec, const ScatterRecord &scatter_record, const RestirSample &sample) const;
+
+	// Independent random numbers for the candidates and the reuse passes, kept apart from the pixel sampler
+	Sampler restir_sampler(uint32_t x, uint32_t y, uint32_t pass) const;
+
+	/**
+	 * @brief One pass of progressive photon mapping (Knaus and Zwicker 2011): photons are traced from the
+	 * emitters and the environment and hashed into a grid, then every pixel gathers them at the first diffuse vertex of its
+	 * camera path. Every pass is an estimate of its own that goes into the accumulation, the gather radius
+	 * shrinks between passes so that the bias vanishes as the passes average out.
+	 */
+	void render_photon_mapping();
+
+	// Traces the photons of one batch into the batch's buffer
+	void trace_photons(uint32_t batch, uint32_t photon_count, const LightSampler &lights);
+
+	// Follows specular bounces to the first diffuse vertex, samples a light there and gathers the photons
+	glm::vec3 photon_mapping_color(uint32_t x, uint32_t y, const LightSampler *lights) const;
+
+	/**
+	 * @brief One bidirectional frame: a camera and a light subpath per pixel, then the light tracing
+	 * splats of all pixels are added to the camera estimates once every pixel has finished.
+	 */
+	void render_bidirectional();
+
+	/**
+	 * @brief One pass of primary sample space Metropolis light transport (Kelemen et al. 2002) over the
+	 * path tracer, for the light scattered at least once. The first pass estimates the mean luminance of a
+	 * path from independent bootstrap samples and starts every chain at a bootstrap sample picked by
+	 * luminance. Every pass then advances all chains, each on its own thread, and splats the expected
+	 * values of their proposals; the splats of a pass, scaled by the bootstrap estimate, are an image of
+	 * their own that goes into the accumulation.
+	 */
+	void render_metropolis();
+
+	// Builds the chains' starting points and the normalization from independent samples
+	void metropolis_bootstrap();
+
+	// Advances a chain by its share of the pass's mutations
+	void metropolis_run_chain(uint32_t chain, uint64_t mutations);
+
+	// Path traced from the primary sample vector, whose first two components pick the pixel, minus the first hit's emission
+	glm::vec3 metropolis_sample(PrimarySampleSpace &primary_sample, uint32_t &x, uint32_t &y) const;
 
   private:
 	Timer timer_;
@@ -33,5 +291,80 @@ class Renderer : public mengze::Renderer
 	int max_depth_ = 10;
 
 	uint32_t cur_y_ = 0;
+
+	SamplerType      sampler_type_         = SamplerType::kSobol;
+	LightSamplerType light_sampler_type_   = LightSamplerType::kLightBvh;
+	IntegratorType   integrator_           = IntegratorType::kPathTracer;
+	bool             solid_angle_sampling_ = false;
+
+	static constexpr int RUSSIAN_ROULETTE_DEPTH = 3;
+
+	static constexpr uint32_t ADAPTIVE_MAX_SAMPLE_FACTOR = 8;
+
+	static constexpr float GUIDING_FRACTION     = 0.5f;        // probability of sampling the guide instead of the BSDF
+	static constexpr int   GUIDING_MAX_VERTICES = 32;          // deeper vertices are not recorded
+
+	std::shared_ptr<PathGuide> path_guide_;
+	bool                       path_guiding_ = false;
+
+	static constexpr float RADIANCE_CACHE_CELL_FRACTION     = 1.0f / 1024.0f;       // of the scene's diagonal, the smallest cells
+	static constexpr float RADIANCE_CACHE_CELL_PIXELS       = 4.0f;                 // footprint of cells seen from the camera
+	static constexpr float RADIANCE_CACHE_TRAINING_FRACTION = 0.1f;                 // of the paths, which write and never end in the cache
+	static constexpr int   RADIANCE_CACHE_MAX_VERTICES      = 16;                   // deeper vertices do not teach the cache
+
+	std::shared_ptr<RadianceCache> radiance_cache_;
+	bool                           radiance_caching_       = false;
+	int                            radiance_cache_bounces_ = 1;
+
+	static constexpr int   ROULETTE_SPLITTING_MAX_VERTICES = 16;          // deeper vertices do not teach the statistics
+	static constexpr float ROULETTE_SPLITTING_MAX_BRANCHES = 16.0f;        // expected branches of a camera path
+
+	std::shared_ptr<RouletteSplitting> splitting_;
+	bool                               roulette_splitting_ = false;
+
+	AdaptiveSampling        adaptive_;
+	AdaptiveSamplingOptions adaptive_options_;
+	bool                    adaptive_sampling_ = false;
+	bool                    noise_heatmap_     = false;
+	bool                    display_dirty_     = false;
+
+	static constexpr int      RESTIR_CANDIDATES        = 32;
+	static constexpr int      RESTIR_SPATIAL_NEIGHBORS = 5;
+	static constexpr float    RESTIR_SPATIAL_RADIUS    = 30.0f;        // pixels
+	static constexpr uint32_t RESTIR_HISTORY_LIMIT     = 20;           // temporal history in multiples of the candidate count
+
+	std::vector<RestirSurface> restir_surfaces_;
+	std::vector<RestirSurface> restir_history_;
+
+	WavefrontPaths wavefront_;
+
+	static constexpr uint32_t PHOTON_BATCHES         = 256;
+	static constexpr float    PHOTON_RADIUS_FRACTION = 0.005f;             // of the scene's diagonal
+	static constexpr float    PHOTON_RADIUS_ALPHA    = 2.0f / 3.0f;        // fraction of the photons a pass keeps in the shrinking radius
+
+	// A buffer per batch, only the thread tracing a batch appends to its buffer
+	std::vector<std::vector<Photon>> photon_buffers_;
+	std::vector<uint32_t>            photon_batch_iter_;
+	PhotonMap                        photon_map_;
+	float                            photon_radius_         = 0.0f;
+	float                            photon_initial_radius_ = 0.0f;
+	uint32_t                         photons_per_pass_      = 0;
+
+	// Pixel estimates of the camera subpaths, held until the splats of the frame are complete
+	std::vector<glm::vec3> bidirectional_radiance_;
+	SplatFilm              splat_film_;        // light tracing and Metropolis splats of the current pass
+
+	static constexpr uint32_t METROPOLIS_BOOTSTRAP_SAMPLES      = 1u << 17;
+	static constexpr uint32_t METROPOLIS_CHAINS                 = 256;
+	static constexpr float    METROPOLIS_SIGMA                  = 0.01f;        // deviation of a small step
+	static constexpr float    METROPOLIS_LARGE_STEP_PROBABILITY = 0.3f;
+
+	std::vector<MetropolisChain> metropolis_chains_;
+	std::vector<uint32_t>        metropolis_chain_iter_;
+	float                        metropolis_normalization_       = 0.0f;        // mean luminance of a path
+	uint32_t                     metropolis_mutations_per_pixel_ = 1;
+
+	bool                  packet_tracing_ = true;
+	std::vector<uint32_t> tile_iter_;
 };
 }
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace mengze::rt
+{
+// Point on an emitter, in area measure so it can be reused at other shading points
+struct RestirSample
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 radiance;
+};
+
+/**
+ * @brief Weighted reservoir holding one light sample out of the candidates streamed through it
+ * (Bitterli et al. 2020).
+ *
+ * target is the target function of the kept sample at the shading point that owns the reservoir and
+ * contribution_weight the unbiased contribution weight W = weight_sum / (count * target).
+ */
+struct Reservoir
+{
+	RestirSample sample;
+	float        weight_sum{0.0f};
+	float        target{0.0f};
+	float        contribution_weight{0.0f};
+	uint32_t     count{0};
+
+	// Streams in one candidate, u is uniform in [0, 1)
+	void update(const RestirSample &candidate, float weight, float candidate_target, float u)
+	{
+		weight_sum += weight;
+		++count;
+		if (weight > 0.0f && u * weight_sum < weight)
+		{
+			sample = candidate;
+			target = candidate_target;
+		}
+	}
+
+	// Merges the reservoir of another pixel or frame, target_here is its sample's target function at
+	// this reservoir's shading point
+	void merge(const Reservoir &other, float target_here, float u)
+	{
+		float weight = target_here * other.contribution_weight * static_cast<float>(other.count);
+		weight_sum += weight;
+		count += other.count;
+		if (weight > 0.0f && u * weight_sum < weight)
+		{
+			sample = other.sample;
+			target = target_here;
+		}
+	}
+
+	void finalize()
+	{
+		contribution_weight = target > 0.0f && count > 0 ? weight_sum / (static_cast<float>(count) * target) : 0.0f;
+	}
+};
+
+// What neighbouring pixels and the next frame need to know about a pixel's primary hit
+struct RestirSurface
+{
+	Reservoir reservoir;
+	glm::vec3 position;
+	glm::vec3 normal;
+	float     depth{0.0f};
+	bool      valid{false};
+};
+}        // namespace mengze::rt
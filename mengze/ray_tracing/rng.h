@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+namespace mengze::rt
+{
+/**
+ * @brief PCG32 (O'Neill, pcg-random.org), 16 bytes of state.
+ *
+ * Samplers seed one generator per pixel sample from the pixel coordinates and the sample index, so
+ * no state is shared between render threads and any pixel can be reproduced in isolation.
+ */
+class Rng
+{
+  public:
+	Rng() = default;
+
+	explicit Rng(uint64_t seed, uint64_t sequence = 0)
+	{
+		state_     = 0;
+		increment_ = (sequence << 1u) | 1u;
+		next_uint();
+		state_ += seed;
+		next_uint();
+	}
+
+	uint32_t next_uint()
+	{
+		uint64_t old_state = state_;
+		state_             = old_state * 6364136223846793005ull + increment_;
+		auto xor_shifted   = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+		auto rotation      = static_cast<uint32_t>(old_state >> 59u);
+		return (xor_shifted >> rotation) | (xor_shifted << ((~rotation + 1u) & 31u));
+	}
+
+	// Uniform in [0, 1), the top 24 bits fill the float mantissa exactly
+	float next_float()
+	{
+		return static_cast<float>(next_uint() >> 8) * 0x1p-24f;
+	}
+
+	float next_float(float min, float max)
+	{
+		return min + (max - min) * next_float();
+	}
+
+	// SplitMix64 finalizer, decorrelates neighbouring seeds
+	static uint64_t mix(uint64_t x)
+	{
+		x += 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+  private:
+	uint64_t state_{0x853c49e6748fea9bull};
+	uint64_t increment_{0xda3e39cb94b95bdbull};
+};
+}        // namespace mengze::rt
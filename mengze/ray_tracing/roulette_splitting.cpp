@@ -0,0 +1,95 @@
+#include "ray_tracing/roulette_splitting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+
+#include "ray_tracing/math.h"
+
+namespace mengze::rt
+{
+void RouletteSplitting::reset(const Aabb &bounds)
+{
+	glm::vec3 extent    = glm::max(bounds.max() - bounds.min(), glm::vec3(1e-4f));
+	float     cell_size = std::max(extent.x, std::max(extent.y, extent.z)) / GRID_RESOLUTION;
+
+	origin_            = bounds.min();
+	inverse_cell_size_ = 1.0f / cell_size;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		resolution_[axis] = std::clamp(static_cast<int>(std::ceil(extent[axis] / cell_size)), 1, GRID_RESOLUTION);
+	}
+	cells_ = std::vector<Cell>(static_cast<size_t>(resolution_[0]) * resolution_[1] * resolution_[2] * 6);
+
+	frame_rays_.store(0, std::memory_order_relaxed);
+	frame_paths_.store(0, std::memory_order_relaxed);
+	path_cost_         = 0.0f;
+	relative_variance_ = 0.0f;
+}
+
+uint32_t RouletteSplitting::cell(const glm::vec3 &p, const glm::vec3 &n) const
+{
+	int index[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		index[axis] = std::clamp(static_cast<int>(std::floor((p[axis] - origin_[axis]) * inverse_cell_size_)), 0, resolution_[axis] - 1);
+	}
+
+	return static_cast<uint32_t>(((index[2] * resolution_[1] + index[1]) * resolution_[0] + index[0]) * 6 + normal_class(n));
+}
+
+void RouletteSplitting::record(uint32_t cell, float luminance, uint32_t rays)
+{
+	auto &target = cells_[cell];
+	atomic_add(target.second_moment_sum, luminance * luminance);
+	atomic_add(target.cost_sum, static_cast<float>(std::max(rays, 1u)));
+	target.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RouletteSplitting::add_path(uint32_t rays)
+{
+	frame_rays_.fetch_add(rays, std::memory_order_relaxed);
+	frame_paths_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool RouletteSplitting::splitting_factor(uint32_t cell, float weight, float &factor) const
+{
+	const auto &source = cells_[cell];
+	if (source.history < MIN_SAMPLES || relative_variance_ <= 0.0f || path_cost_ <= 0.0f)
+	{
+		return false;
+	}
+
+	// Minimizes variance times cost: the branches' share of the pixel's variance over their share of the cost
+	factor = weight * std::sqrt(source.second_moment / source.cost * path_cost_ / relative_variance_);
+	factor = std::clamp(factor, MIN_FACTOR, MAX_FACTOR);
+	return true;
+}
+
+void RouletteSplitting::update(float relative_variance)
+{
+	std::for_each(std::execution::par, cells_.begin(), cells_.end(), [](Cell &cell) {
+		uint32_t count  = cell.count.exchange(0, std::memory_order_relaxed);
+		float    moment = cell.second_moment_sum.exchange(0.0f, std::memory_order_relaxed);
+		float    cost   = cell.cost_sum.exchange(0.0f, std::memory_order_relaxed);
+		if (count == 0)
+		{
+			return;
+		}
+
+		auto history       = static_cast<float>(std::min(cell.history, MAX_HISTORY - std::min(count, MAX_HISTORY)));
+		auto total         = history + static_cast<float>(count);
+		cell.second_moment = (cell.second_moment * history + moment) / total;
+		cell.cost          = (cell.cost * history + cost) / total;
+		cell.history       = std::min(cell.history + count, MAX_HISTORY);
+	});
+
+	uint64_t rays  = frame_rays_.exchange(0, std::memory_order_relaxed);
+	uint64_t paths = frame_paths_.exchange(0, std::memory_order_relaxed);
+	if (paths > 0)
+	{
+		path_cost_ = static_cast<float>(static_cast<double>(rays) / static_cast<double>(paths));
+	}
+	relative_variance_ = relative_variance;
+}
+}        // namespace mengze::rt
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/aabb.h"
+
+namespace mengze::rt
+{
+/**
+ * @brief Statistics for efficiency-aware Russian roulette and splitting (Rath et al. 2022), learned on
+ * a world-space grid while the image renders.
+ *
+ * Every cell learns the second moment of the radiance its surfaces reflect, per unit of throughput
+ * reaching them, and the cost of estimating it, in rays traced after the vertex. Together with the cost
+ * of a whole camera path and the relative variance of a pixel sample, which the renderer measures, they
+ * give the number of branches that minimizes the relative error of the image per unit of work: paths
+ * carrying much of their pixel split, the others are killed. Cells are cubes, split by the dominant axis
+ * and sign of the normal like the radiance cache's. Records are added lock free during a frame and
+ * merged between frames.
+ */
+class RouletteSplitting
+{
+  public:
+	// Forgets everything learned, the longest side of bounds is split into GRID_RESOLUTION cells
+	void reset(const Aabb &bounds);
+
+	// Cell of a surface point, points outside the bounds fall into the nearest cell
+	uint32_t cell(const glm::vec3 &p, const glm::vec3 &n) const;
+
+	// Adds the luminance of one estimate of the radiance a vertex of the cell reflects and the rays it took
+	void record(uint32_t cell, float luminance, uint32_t rays);
+
+	// Adds a camera path and every ray it traced, its branches included
+	void add_path(uint32_t rays);
+
+	/**
+	 * @brief Expected number of branches of a path reaching the cell, below 1 the probability that it
+	 * survives. weight is the luminance of the throughput over that of the pixel. False while the cell or
+	 * the image has no statistics.
+	 */
+	bool splitting_factor(uint32_t cell, float weight, float &factor) const;
+
+	// Ends a frame: merges its records, relative_variance is that of a pixel sample averaged over the image
+	void update(float relative_variance);
+
+  private:
+	struct Cell
+	{
+		std::atomic<float>    second_moment_sum{0.0f};
+		std::atomic<float>    cost_sum{0.0f};
+		std::atomic<uint32_t> count{0};
+
+		float    second_moment{0.0f};
+		float    cost{0.0f};
+		uint32_t history{0};        // records merged into second_moment and cost
+	};
+
+	static constexpr int      GRID_RESOLUTION = 32;
+	static constexpr uint32_t MIN_SAMPLES     = 16;
+	static constexpr uint32_t MAX_HISTORY     = 4096;        // records, older ones fade out as the estimator changes
+	static constexpr float    MIN_FACTOR      = 0.05f;
+	static constexpr float    MAX_FACTOR      = 8.0f;
+
+	std::vector<Cell> cells_;
+	glm::vec3         origin_{0.0f};
+	float             inverse_cell_size_{0.0f};
+	int               resolution_[3]{};
+
+	std::atomic<uint64_t> frame_rays_{0};
+	std::atomic<uint64_t> frame_paths_{0};
+	float                 path_cost_{0.0f};        // rays of a camera path
+	float                 relative_variance_{0.0f};
+};
+}        // namespace mengze::rt
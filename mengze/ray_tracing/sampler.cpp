@@ -0,0 +1,363 @@
+#include "ray_tracing/sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "ray_tracing/metropolis.h"
+
+namespace mengze::rt
+{
+namespace
+{
+constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+constexpr uint32_t BLUE_NOISE_SIZE = 64;
+
+uint32_t reverse_bits(uint32_t x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// First two Sobol dimensions: van der Corput and the Pascal matrix (Kollig and Keller 2002)
+uint32_t sobol(uint32_t index, int dimension)
+{
+	if (dimension == 0)
+	{
+		return reverse_bits(index);
+	}
+
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+	{
+		if (index & 1)
+		{
+			result ^= v;
+		}
+	}
+	return result;
+}
+
+// Hash-based Owen scrambling (Burley 2020, "Practical Hash-based Owen Scrambling")
+uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+	return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+float to_unit_float(uint32_t x)
+{
+	return std::min(static_cast<float>(x) * 0x1p-32f, ONE_MINUS_EPSILON);
+}
+
+// Cranley-Patterson rotation
+float rotate(float value, float offset)
+{
+	value += offset;
+	return std::min(value < 1.0f ? value : value - 1.0f, ONE_MINUS_EPSILON);
+}
+
+// Element i of a random permutation of [0, length) selected by seed (Kensler 2013)
+uint32_t permutation_element(uint32_t i, uint32_t length, uint32_t seed)
+{
+	uint32_t w = length - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do
+	{
+		i ^= seed;
+		i *= 0xe170893du;
+		i ^= seed >> 16;
+		i ^= (i & w) >> 4;
+		i ^= seed >> 8;
+		i *= 0x0929eb3fu;
+		i ^= seed >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | seed >> 27;
+		i *= 0x6935fa69u;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303u;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3u;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3dfu;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= length);
+	return (i + seed) % length;
+}
+
+// Void-and-cluster (Ulichney 1993) on a toroidal grid, each texel holds its rank in [0, 1)
+std::vector<float> generate_blue_noise()
+{
+	constexpr uint32_t size  = BLUE_NOISE_SIZE;
+	constexpr uint32_t count = size * size;
+	constexpr float    sigma = 1.5f;
+
+	std::vector<float> kernel(count);
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			float dx             = static_cast<float>(std::min(x, size - x));
+			float dy             = static_cast<float>(std::min(y, size - y));
+			kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+		}
+	}
+
+	std::vector<uint8_t> pattern(count, 0);
+	std::vector<float>   energy(count, 0.0f);
+
+	auto toggle = [&](uint32_t p, bool on) {
+		pattern[p]     = on;
+		float    sign  = on ? 1.0f : -1.0f;
+		uint32_t px    = p % size;
+		uint32_t py    = p / size;
+		for (uint32_t q = 0; q < count; ++q)
+		{
+			uint32_t dx = (q % size - px) & (size - 1);
+			uint32_t dy = (q / size - py) & (size - 1);
+			energy[q] += sign * kernel[dy * size + dx];
+		}
+	};
+	auto tightest_cluster = [&]() {
+		uint32_t best = UINT32_MAX;
+		for (uint32_t p = 0; p < count; ++p)
+		{
+			if (pattern[p] && (best == UINT32_MAX || energy[p] > energy[best]))
+				best = p;
+		}
+		return best;
+	};
+	auto largest_void = [&]() {
+		uint32_t best = UINT32_MAX;
+		for (uint32_t p = 0; p < count; ++p)
+		{
+			if (!pattern[p] && (best == UINT32_MAX || energy[p] < energy[best]))
+				best = p;
+		}
+		return best;
+	};
+
+	// Initial pattern: random points, relaxed by moving the tightest cluster into the largest void
+	Rng      rng(0x5eed);
+	uint32_t initial_count = count / 10;
+	for (uint32_t placed = 0; placed < initial_count;)
+	{
+		uint32_t p = rng.next_uint() % count;
+		if (!pattern[p])
+		{
+			toggle(p, true);
+			++placed;
+		}
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t cluster = tightest_cluster();
+		toggle(cluster, false);
+		uint32_t hole = largest_void();
+		toggle(hole, true);
+		if (hole == cluster)
+		{
+			break;
+		}
+	}
+
+	std::vector<uint32_t> rank(count);
+	auto                  initial_pattern = pattern;
+	auto                  initial_energy  = energy;
+
+	for (uint32_t r = initial_count; r-- > 0;)
+	{
+		uint32_t cluster = tightest_cluster();
+		toggle(cluster, false);
+		rank[cluster] = r;
+	}
+
+	pattern = std::move(initial_pattern);
+	energy  = std::move(initial_energy);
+	for (uint32_t r = initial_count; r < count; ++r)
+	{
+		uint32_t hole = largest_void();
+		toggle(hole, true);
+		rank[hole] = r;
+	}
+
+	std::vector<float> mask(count);
+	for (uint32_t p = 0; p < count; ++p)
+	{
+		mask[p] = (static_cast<float>(rank[p]) + 0.5f) / count;
+	}
+	return mask;
+}
+
+float blue_noise(uint32_t x, uint32_t y)
+{
+	static const std::vector<float> mask = generate_blue_noise();
+	return mask[(y % BLUE_NOISE_SIZE) * BLUE_NOISE_SIZE + x % BLUE_NOISE_SIZE];
+}
+}        // namespace
+
+const char *to_string(SamplerType type)
+{
+	switch (type)
+	{
+		case SamplerType::kIndependent:
+			return "independent";
+		case SamplerType::kStratified:
+			return "stratified";
+		case SamplerType::kSobol:
+			return "sobol";
+		case SamplerType::kBlueNoise:
+			return "blue noise";
+		case SamplerType::kPrimarySample:
+			return "primary sample";
+	}
+	return "unknown";
+}
+
+Sampler::Sampler(SamplerType type, uint32_t samples_per_pixel, uint32_t seed) :
+    type_(type), samples_per_pixel_(std::max(samples_per_pixel, 1u)), seed_(seed)
+{
+	// Primary samples come from a Metropolis chain, a pixel sampler without one draws independent numbers
+	if (type_ == SamplerType::kPrimarySample)
+	{
+		type_ = SamplerType::kIndependent;
+	}
+	if (type_ == SamplerType::kBlueNoise)
+	{
+		// Builds the mask once up front rather than inside the first render pass
+		blue_noise(0, 0);
+	}
+}
+
+Sampler::Sampler(PrimarySampleSpace &primary_sample) :
+    type_(SamplerType::kPrimarySample), primary_sample_(&primary_sample)
+{
+}
+
+void Sampler::start_pixel_sample(uint32_t x, uint32_t y, uint32_t sample_index)
+{
+	x_            = x;
+	y_            = y;
+	sample_index_ = sample_index;
+	dimension_    = 0;
+	rng_          = Rng(Rng::mix((static_cast<uint64_t>(y) << 32 | x) ^ seed_), sample_index);
+}
+
+float Sampler::get_1d()
+{
+	auto dimension = dimension_++;
+	switch (type_)
+	{
+		case SamplerType::kStratified:
+			return stratified_1d(dimension);
+		case SamplerType::kSobol:
+		{
+			auto seed  = hash(dimension);
+			auto index = nested_uniform_scramble(sample_index_, seed);
+			return to_unit_float(nested_uniform_scramble(sobol(index, 0), seed ^ 0xa511e9b3u));
+		}
+		case SamplerType::kBlueNoise:
+		{
+			auto seed  = image_seed(dimension);
+			auto index = nested_uniform_scramble(sample_index_, seed);
+			auto value = to_unit_float(nested_uniform_scramble(sobol(index, 0), seed ^ 0xa511e9b3u));
+			auto shift = dimension * 17;
+			return rotate(value, blue_noise(x_ + shift, y_ + 3 * shift));
+		}
+		case SamplerType::kPrimarySample:
+			return primary_sample_->next();
+		case SamplerType::kIndependent:
+		default:
+			return rng_.next_float();
+	}
+}
+
+glm::vec2 Sampler::get_2d()
+{
+	auto dimension = dimension_++;
+	switch (type_)
+	{
+		case SamplerType::kStratified:
+			return stratified_2d(dimension);
+		case SamplerType::kSobol:
+			return sobol_2d(dimension, hash(dimension));
+		case SamplerType::kBlueNoise:
+		{
+			// One sequence for the whole image, decorrelated between pixels by a toroidal rotation
+			glm::vec2 value = sobol_2d(dimension, image_seed(dimension));
+			auto      shift = dimension * 17;
+			return {rotate(value.x, blue_noise(x_ + shift, y_ + 3 * shift)),
+			        rotate(value.y, blue_noise(x_ + 29 + shift, y_ + 41 + 3 * shift))};
+		}
+		case SamplerType::kPrimarySample:
+		{
+			float u = primary_sample_->next();
+			return {u, primary_sample_->next()};
+		}
+		case SamplerType::kIndependent:
+		default:
+		{
+			float u = rng_.next_float();
+			return {u, rng_.next_float()};
+		}
+	}
+}
+
+float Sampler::stratified_1d(uint32_t dimension)
+{
+	uint32_t stratum = permutation_element(sample_index_ % samples_per_pixel_, samples_per_pixel_, hash(dimension));
+	return (static_cast<float>(stratum) + rng_.next_float()) / samples_per_pixel_;
+}
+
+glm::vec2 Sampler::stratified_2d(uint32_t dimension)
+{
+	// The largest nx * ny grid that fits into the sample count, further samples revisit the strata
+	uint32_t nx      = std::max(1u, static_cast<uint32_t>(std::sqrt(static_cast<float>(samples_per_pixel_))));
+	uint32_t ny      = samples_per_pixel_ / nx;
+	uint32_t strata  = nx * ny;
+	uint32_t stratum = permutation_element(sample_index_ % strata, strata, hash(dimension));
+
+	float jitter_x = rng_.next_float();
+	float jitter_y = rng_.next_float();
+	return {(static_cast<float>(stratum % nx) + jitter_x) / nx, (static_cast<float>(stratum / nx) + jitter_y) / ny};
+}
+
+glm::vec2 Sampler::sobol_2d(uint32_t dimension, uint32_t scramble_seed)
+{
+	// Every dimension pair is a (0, 2)-sequence with its own shuffled index, which pads the two
+	// Sobol dimensions to any number of pairs
+	auto index = nested_uniform_scramble(sample_index_, scramble_seed);
+	auto x     = nested_uniform_scramble(sobol(index, 0), scramble_seed ^ 0xa511e9b3u);
+	auto y     = nested_uniform_scramble(sobol(index, 1), scramble_seed ^ 0x63d83595u);
+	return {to_unit_float(x), to_unit_float(y)};
+}
+
+uint32_t Sampler::image_seed(uint32_t dimension) const
+{
+	return static_cast<uint32_t>(Rng::mix(static_cast<uint64_t>(seed_) << 32 | dimension));
+}
+
+uint32_t Sampler::hash(uint32_t dimension) const
+{
+	uint64_t pixel = static_cast<uint64_t>(y_) << 32 | x_;
+	return static_cast<uint32_t>(Rng::mix(pixel ^ Rng::mix(static_cast<uint64_t>(seed_) << 32 | dimension)));
+}
+}        // namespace mengze::rt
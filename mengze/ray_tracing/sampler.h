@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/rng.h"
+
+namespace mengze::rt
+{
+class PrimarySampleSpace;
+
+enum class SamplerType
+{
+	kIndependent,
+	kStratified,
+	kSobol,             // Owen-scrambled Sobol, scrambled per pixel
+	kBlueNoise,         // Owen-scrambled Sobol shared by all pixels, rotated per pixel by a blue noise mask
+	kPrimarySample,     // components of a Metropolis chain's primary sample vector
+};
+
+const char *to_string(SamplerType type);
+
+/**
+ * @brief Sample generator for one pixel sample at a time.
+ *
+ * Consumers draw dimensions in order through get_1d() and get_2d(). The n-th 2D request of every
+ * sample of a pixel comes from the same 2D point set, so pixel jitter, the first bounce and so on are
+ * each well distributed over the samples of a pixel. The sampler is a small value type meant to live
+ * on the stack of the thread that renders the sample.
+ */
+class Sampler
+{
+  public:
+	Sampler() = default;
+
+	Sampler(SamplerType type, uint32_t samples_per_pixel, uint32_t seed = 0);
+
+	// Hands out the components of the primary sample vector in order, the vector has to outlive the sampler
+	explicit Sampler(PrimarySampleSpace &primary_sample);
+
+	// Starts a new sample, dimensions restart at 0
+	void start_pixel_sample(uint32_t x, uint32_t y, uint32_t sample_index);
+
+	float get_1d();
+
+	glm::vec2 get_2d();
+
+	SamplerType type() const
+	{
+		return type_;
+	}
+
+	// Pixel of the current sample, meaningless for primary sample space samplers
+	uint32_t pixel_x() const
+	{
+		return x_;
+	}
+
+	uint32_t pixel_y() const
+	{
+		return y_;
+	}
+
+  private:
+	float stratified_1d(uint32_t dimension);
+
+	glm::vec2 stratified_2d(uint32_t dimension);
+
+	glm::vec2 sobol_2d(uint32_t dimension, uint32_t scramble_seed);
+
+	// Seed shared by all pixels
+	uint32_t image_seed(uint32_t dimension) const;
+
+	// Seed of this pixel
+	uint32_t hash(uint32_t dimension) const;
+
+  private:
+	SamplerType type_{SamplerType::kIndependent};
+	uint32_t    samples_per_pixel_{1};
+	uint32_t    seed_{0};
+
+	uint32_t x_{0};
+	uint32_t y_{0};
+	uint32_t sample_index_{0};
+	uint32_t dimension_{0};
+
+	Rng                 rng_;
+	PrimarySampleSpace *primary_sample_{nullptr};
+};
+}        // namespace mengze::rt
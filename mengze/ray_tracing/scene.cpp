@@ -9,7 +9,7 @@
 
 #include "core/logging.h"
 #include "ray_tracing/bvh.h"
-#include "ray_tracing/triangle.h"
+#include "ray_tracing/triangle_mesh.h"
 
 namespace mengze::rt
 {
@@ -38,23 +38,24 @@ bool HittableList::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
 	return hit_anything;
 }
 
-float HittableList::pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const
+bool HittableList::occluded(const Ray &r, Interval ray_t) const
 {
-	auto weight = 1.0f / objects_.size();
-	auto sum    = 0.0f;
-
 	for (const auto &object : objects_)
 	{
-		sum += weight * object->pdf_value(origin, direction);
+		if (object->occluded(r, ray_t))
+		{
+			return true;
+		}
 	}
-	return sum;
+	return false;
 }
 
-glm::vec3 HittableList::random(const glm::vec3 &origin) const
+void HittableList::collect_emitters(std::vector<Emitter> &emitters)
 {
-	auto index = static_cast<int>(random_float() * objects_.size());
-	index      = std::min(index, static_cast<int>(objects_.size()) - 1);
-	return objects_[index]->random(origin);
+	for (const auto &object : objects_)
+	{
+		object->collect_emitters(emitters);
+	}
 }
 
 const std::vector<std::shared_ptr<Hittable>> &HittableList::objects() const
@@ -167,11 +168,100 @@ void Scene::parse_xml(const std::string &file_path)
 void Scene::add(const std::shared_ptr<Hittable> &object)
 {
 	world_.add(object);
+	top_level_dirty_ = true;
 }
 
 void Scene::add_light(const std::shared_ptr<Hittable> &light)
 {
 	lights_.add(light);
+	lights_dirty_ = true;
+}
+
+void Scene::build_top_level()
+{
+	if (!top_level_dirty_ && top_level_)
+	{
+		return;
+	}
+
+	// Every object is a whole bottom-level tree or a primitive, keep one per leaf
+	BvhBuildOptions options;
+	options.max_leaf_size = 1;
+
+	top_level_ = std::make_shared<Bvh>(world_, options);
+	if (wide_bvh_)
+	{
+		top_level_->collapse();
+	}
+	top_level_dirty_ = false;
+
+	LOGI("Built top-level BVH: {} objects, {} nodes, {:.1f} ms", world_.objects().size(), top_level_->node_count(), top_level_->build_time())
+}
+
+const Hittable &Scene::top_level() const
+{
+	return *top_level_;
+}
+
+void Scene::build_lights()
+{
+	if (!lights_dirty_ && light_bvh_)
+	{
+		return;
+	}
+
+	std::vector<Emitter> emitters;
+	lights_.collect_emitters(emitters);
+
+	power_light_sampler_ = std::make_shared<PowerLightSampler>(emitters);
+	light_bvh_           = std::make_shared<LightBvh>(std::move(emitters));
+	lights_dirty_        = false;
+	set_solid_angle_sampling(solid_angle_sampling_);
+
+	// Environment samples are placed outside the sphere around everything in the world
+	if (environment_)
+	{
+		Aabb      bounds = world_.bounding_box();
+		glm::vec3 center = world_.empty() ? glm::vec3{0.0f} : 0.5f * (bounds.min() + bounds.max());
+		float     radius = world_.empty() ? 1.0f : 0.5f * glm::length(bounds.max() - bounds.min());
+		power_light_sampler_->set_environment(environment_.get(), center, radius);
+		light_bvh_->set_environment(environment_.get(), center, radius);
+	}
+
+	LOGI("Built light BVH: {} emitters, {} nodes, {:.1f} ms", light_bvh_->emitter_count(), light_bvh_->node_count(), light_bvh_->build_time())
+}
+
+const LightSampler *Scene::light_sampler(LightSamplerType type) const
+{
+	const LightSampler *sampler = nullptr;
+	if (type == LightSamplerType::kPower)
+	{
+		sampler = power_light_sampler_.get();
+	}
+	else
+	{
+		sampler = light_bvh_.get();
+	}
+	return sampler && !sampler->empty() ? sampler : nullptr;
+}
+
+void Scene::set_solid_angle_sampling(bool enabled)
+{
+	solid_angle_sampling_ = enabled;
+	if (power_light_sampler_)
+	{
+		power_light_sampler_->set_solid_angle_sampling(enabled);
+	}
+	if (light_bvh_)
+	{
+		light_bvh_->set_solid_angle_sampling(enabled);
+	}
+}
+
+void Scene::set_environment(const std::shared_ptr<EnvironmentLight> &environment)
+{
+	environment_  = environment;
+	lights_dirty_ = true;
 }
 
 void Scene::process_node(const aiNode *node, const aiScene *scene)
@@ -195,11 +285,6 @@ void Scene::process_mesh(const aiMesh *mesh, const aiScene *scene)
 	//if (strcmp(mesh->mName.C_Str(), "Floor")!=0)
 	//	return;
 
-	std::vector<std::shared_ptr<Hittable>> triangles;
-
-	std::vector<glm::vec3> vertices;
-	vertices.reserve(mesh->mNumVertices);
-
 	std::shared_ptr<Material> material;
 	if (mesh->mMaterialIndex >= 0)
 	{
@@ -215,11 +300,25 @@ void Scene::process_mesh(const aiMesh *mesh, const aiScene *scene)
 	}
 #endif
 
+	std::vector<glm::vec3> positions;
+	positions.reserve(mesh->mNumVertices);
 	for (size_t i = 0; i < mesh->mNumVertices; i++)
 	{
-		vertices.emplace_back(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		positions.emplace_back(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
 	}
 
+	std::vector<glm::vec2> uvs;
+	if (mesh->HasTextureCoords(0))
+	{
+		uvs.reserve(mesh->mNumVertices);
+		for (size_t i = 0; i < mesh->mNumVertices; i++)
+		{
+			uvs.emplace_back(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	indices.reserve(mesh->mNumFaces * 3);
 	for (size_t i = 0; i < mesh->mNumFaces; i++)
 	{
 		const auto &face = mesh->mFaces[i];
@@ -229,45 +328,25 @@ void Scene::process_mesh(const aiMesh *mesh, const aiScene *scene)
 			continue;
 		}
 
-		const auto &v0 = vertices[face.mIndices[0]];
-		const auto &v1 = vertices[face.mIndices[1]];
-		const auto &v2 = vertices[face.mIndices[2]];
-
-
-		if (mesh->HasTextureCoords(0))
-		{
-			std::array<glm::vec2, 3> uv;
-			uv[0] = glm::vec2(mesh->mTextureCoords[0][face.mIndices[0]].x, mesh->mTextureCoords[0][face.mIndices[0]].y);
-			uv[1] = glm::vec2(mesh->mTextureCoords[0][face.mIndices[1]].x, mesh->mTextureCoords[0][face.mIndices[1]].y);
-			uv[2] = glm::vec2(mesh->mTextureCoords[0][face.mIndices[2]].x, mesh->mTextureCoords[0][face.mIndices[2]].y);
-			triangles.push_back(std::make_shared<Triangle>(v0, v1, v2, material, uv));
-		}
-		else
-		{
-			triangles.push_back(std::make_shared<Triangle>(v0, v1, v2, material, std::nullopt));
-		}
+		indices.push_back(face.mIndices[0]);
+		indices.push_back(face.mIndices[1]);
+		indices.push_back(face.mIndices[2]);
 	}
 
-	if (triangles.size() > 0)
+	if (!indices.empty())
 	{
-		auto bvh_tree = std::make_shared<BvhNode>(triangles, 0, triangles.size());
-		add(bvh_tree);
-
-		if (material->is_light())
+		auto triangle_mesh = std::make_shared<TriangleMesh>(std::move(positions), std::move(uvs), indices, material);
+		if (wide_bvh_)
 		{
-			add_light(bvh_tree);
+			triangle_mesh->collapse();
 		}
-	}
+		LOGI("Built mesh: {} triangles, {} nodes, {:.1f} KB, SAH cost {:.2f}, {:.1f} ms", triangle_mesh->triangle_count(), triangle_mesh->node_count(),
+		     triangle_mesh->memory_usage() / 1024.0f, triangle_mesh->sah_cost(), triangle_mesh->build_time())
+		add(triangle_mesh);
 
-	else
-	{
-		for (const auto &triangle : triangles)
+		if (material->is_light())
 		{
-			add(triangle);
-			if (material->is_light())
-			{
-				add_light(triangle);
-			}
+			add_light(triangle_mesh);
 		}
 	}
 
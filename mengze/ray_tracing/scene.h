@@ -7,11 +7,14 @@
 
 #include "ray_tracing/hittable.h"
 #include "ray_tracing/camera.h"
+#include "ray_tracing/environment_light.h"
+#include "ray_tracing/light_bvh.h"
 
 namespace fs = std::filesystem;
 
 namespace mengze::rt
 {
+class Bvh;
 
 class HittableList : public Hittable
 {
@@ -20,9 +23,9 @@ class HittableList : public Hittable
 
 	bool hit(const Ray &r, Interval ray_t, HitRecord &rec) const override;
 
-	float pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const override;
+	bool occluded(const Ray &r, Interval ray_t) const override;
 
-	glm::vec3 random(const glm::vec3 &origin) const override;
+	void collect_emitters(std::vector<Emitter> &emitters) override;
 
 	const std::vector<std::shared_ptr<Hittable>> &objects() const;
 
@@ -46,6 +49,38 @@ class Scene
 
 	void add_light(const std::shared_ptr<Hittable> &light);
 
+	// Rebuilds the top-level BVH over everything added to the world. The per-mesh trees are kept as
+	// they are, so only this level is rebuilt when objects are added.
+	void build_top_level();
+
+	// Top-level BVH over the world, call build_top_level() after adding objects
+	const Hittable &top_level() const;
+
+	// Collects the emissive triangles of every light added so far into the emitter table and builds the
+	// light samplers over it
+	void build_lights();
+
+	// Null when the lights have no emissive triangles
+	const LightSampler *light_sampler(LightSamplerType type) const;
+
+	// Applies LightSampler::set_solid_angle_sampling() to every light sampler, also those built later
+	void set_solid_angle_sampling(bool enabled);
+
+	// Radiance of rays that leave the scene, sampled by the light samplers built from now on. Null removes it
+	void set_environment(const std::shared_ptr<EnvironmentLight> &environment);
+
+	// Null without environment
+	const EnvironmentLight *environment() const
+	{
+		return environment_.get();
+	}
+
+	// Collapse BVHs built from now on into BVH4/BVH8 for SIMD traversal
+	void set_wide_bvh(bool enabled)
+	{
+		wide_bvh_ = enabled;
+	}
+
 	std::shared_ptr<Camera> camera() const
 	{
 		return camera_;
@@ -69,6 +104,16 @@ private:
 	HittableList world_;
 	HittableList lights_;
 
+	std::shared_ptr<Bvh> top_level_;
+	bool                 top_level_dirty_{true};
+	bool                 wide_bvh_{true};
+
+	std::shared_ptr<PowerLightSampler> power_light_sampler_;
+	std::shared_ptr<LightBvh>          light_bvh_;
+	bool                               lights_dirty_{true};
+	bool                               solid_angle_sampling_{false};
+	std::shared_ptr<EnvironmentLight>  environment_;
+
 	std::unordered_map<std::string, glm::vec3> lights_radiance_;
 
 	std::shared_ptr<Camera> camera_;
@@ -39,7 +39,9 @@ class Sphere : public Hittable
 		rec.position             = r.at(rec.t);
 		glm::vec3 outward_normal = (rec.position - center_) / radius_;
 		rec.set_face_normal(r, outward_normal);
-		rec.material = material_;
+		rec.material     = material_;
+		rec.primitive_id = 0;
+		rec.light_id     = INVALID_LIGHT_ID;
 
 		return true;
 	}
@@ -0,0 +1,127 @@
+#include "ray_tracing/splat_film.h"
+
+#include <algorithm>
+#include <execution>
+#include <thread>
+
+namespace mengze::rt
+{
+namespace
+{
+// Slots are handed out per thread and returned when the thread exits, so they stay below the number of live threads
+std::mutex            slot_mutex;
+std::vector<uint32_t> free_slots;
+uint32_t              slot_count = 0;
+
+struct ThreadSlot
+{
+	uint32_t index;
+
+	ThreadSlot()
+	{
+		std::lock_guard<std::mutex> lock(slot_mutex);
+		if (free_slots.empty())
+		{
+			index = slot_count++;
+		}
+		else
+		{
+			index = free_slots.back();
+			free_slots.pop_back();
+		}
+	}
+
+	~ThreadSlot()
+	{
+		std::lock_guard<std::mutex> lock(slot_mutex);
+		free_slots.push_back(index);
+	}
+};
+
+uint32_t thread_slot()
+{
+	thread_local ThreadSlot slot;
+	return slot.index;
+}
+}        // namespace
+
+void SplatFilm::resize(uint32_t width, uint32_t height)
+{
+	std::lock_guard<std::mutex> lock(films_mutex_);
+	films_.clear();
+	slot_films_.assign(std::max(4 * std::thread::hardware_concurrency(), MIN_THREAD_SLOTS), nullptr);
+	shared_film_ = nullptr;
+	width_       = width;
+	height_      = height;
+	tiles_x_     = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y_     = (height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+SplatFilm::ThreadFilm *SplatFilm::create_film()
+{
+	films_.push_back(std::make_unique<ThreadFilm>());
+	films_.back()->tiles.resize(static_cast<size_t>(tiles_x_) * tiles_y_);
+	return films_.back().get();
+}
+
+void SplatFilm::add(uint32_t x, uint32_t y, const glm::vec3 &value)
+{
+	uint32_t slot = thread_slot();
+	if (slot >= slot_films_.size())
+	{
+		// More live threads than slots, the rest share one film
+		std::lock_guard<std::mutex> lock(films_mutex_);
+		if (!shared_film_)
+		{
+			shared_film_ = create_film();
+		}
+		add(*shared_film_, x, y, value);
+		return;
+	}
+
+	// A slot's entry is only written by the thread holding it, a thread reusing the slot of one that exited also takes over its film
+	ThreadFilm *&film = slot_films_[slot];
+	if (!film)
+	{
+		std::lock_guard<std::mutex> lock(films_mutex_);
+		film = create_film();
+	}
+	add(*film, x, y, value);
+}
+
+void SplatFilm::add(ThreadFilm &film, uint32_t x, uint32_t y, const glm::vec3 &value)
+{
+	auto &tile = film.tiles[(y / TILE_SIZE) * tiles_x_ + x / TILE_SIZE];
+	if (tile.empty())
+	{
+		tile.assign(TILE_SIZE * TILE_SIZE, glm::vec3{0.0f});
+	}
+	tile[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] += value;
+}
+
+glm::vec3 SplatFilm::sum(uint32_t x, uint32_t y) const
+{
+	size_t    tile_index  = (y / TILE_SIZE) * tiles_x_ + x / TILE_SIZE;
+	size_t    pixel_index = (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+	glm::vec3 total{0.0f};
+	for (const auto &film : films_)
+	{
+		const auto &tile = film->tiles[tile_index];
+		if (!tile.empty())
+		{
+			total += tile[pixel_index];
+		}
+	}
+	return total;
+}
+
+void SplatFilm::clear()
+{
+	std::for_each(std::execution::par, films_.begin(), films_.end(), [](const std::unique_ptr<ThreadFilm> &film) {
+		for (auto &tile : film->tiles)
+		{
+			std::fill(tile.begin(), tile.end(), glm::vec3{0.0f});
+		}
+	});
+}
+}        // namespace mengze::rt
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace mengze::rt
+{
+/**
+ * @brief Image that many threads add to at arbitrary pixels, such as the light tracing contributions of
+ * a bidirectional path tracer.
+ *
+ * Every thread writes to a film of its own, so adding is a plain store without atomics or locks. A
+ * thread finds its film through a slot number that is unique among the live threads, so any number of
+ * splat films can be in use side by side. The films are split into tiles that are allocated the first
+ * time their thread writes to them, a thread whose splats stay in a corner of the image only pays for
+ * that corner. The films are summed when the pass that wrote them has finished.
+ */
+class SplatFilm
+{
+  public:
+	// Drops the films of all threads and starts over with the given image size
+	void resize(uint32_t width, uint32_t height);
+
+	// Adds to a pixel of the calling thread's film
+	void add(uint32_t x, uint32_t y, const glm::vec3 &value);
+
+	// Sum over the films of all threads, must not run while threads still add
+	glm::vec3 sum(uint32_t x, uint32_t y) const;
+
+	// Zeroes the films and keeps their tiles for the next pass
+	void clear();
+
+  private:
+	struct ThreadFilm
+	{
+		std::vector<std::vector<glm::vec3>> tiles;        // empty until the thread writes to the tile
+	};
+
+	void add(ThreadFilm &film, uint32_t x, uint32_t y, const glm::vec3 &value);
+
+	ThreadFilm *create_film();
+
+	static constexpr uint32_t TILE_SIZE        = 32;
+	static constexpr uint32_t MIN_THREAD_SLOTS = 64;
+
+	std::vector<std::unique_ptr<ThreadFilm>> films_;
+	std::vector<ThreadFilm *>                slot_films_;                  // by thread slot, only touched by the slot's thread
+	ThreadFilm                              *shared_film_{nullptr};        // for threads beyond the slots, written under the lock
+	std::mutex                               films_mutex_;                 // taken by a thread's first splat and by shared splats
+
+	uint32_t width_{0};
+	uint32_t height_{0};
+	uint32_t tiles_x_{0};
+	uint32_t tiles_y_{0};
+};
+}        // namespace mengze::rt
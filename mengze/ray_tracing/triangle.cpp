@@ -8,11 +8,10 @@ Triangle::Triangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2
 	if (uv)
 		uv_ = uv.value();
 	normal_ = glm::normalize(glm::cross(v1_ - v0_, v2_ - v0_));
-	area_   = 0.5f * glm::length(glm::cross(v1_ - v0_, v2_ - v0_));
 	set_bounding_box();
 }
 
-bool Triangle::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
+bool Triangle::intersect(const Ray &r, const Interval &ray_t, float &t, float &u, float &v) const
 {
 	constexpr float epsilon = 1e-8f;
 
@@ -26,25 +25,33 @@ bool Triangle::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
 
 	float     f = 1.0f / a;
 	glm::vec3 s = r.origin() - v0_;
-	float     u = f * glm::dot(s, h);
+	u           = f * glm::dot(s, h);
 
 	if (u < 0.0f || u > 1.0f)
 		return false;
 
 	glm::vec3 q = glm::cross(s, edge1);
-	float     v = f * glm::dot(r.direction(), q);
+	v           = f * glm::dot(r.direction(), q);
 
 	if (v < 0.0f || u + v > 1.0f)
 		return false;
 
-	float t = f * glm::dot(edge2, q);
+	t = f * glm::dot(edge2, q);
+
+	return t >= ray_t.min() && t <= ray_t.max();
+}
 
-	if (t < ray_t.min() || t > ray_t.max())
+bool Triangle::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
+{
+	float t, u, v;
+	if (!intersect(r, ray_t, t, u, v))
 		return false;
 
-	rec.t        = t;
-	rec.position = r.at(t);
-	rec.material = material_;
+	rec.t            = t;
+	rec.position     = r.at(t);
+	rec.material     = material_;
+	rec.primitive_id = 0;
+	rec.light_id     = light_id_;
 	rec.set_face_normal(r, normal_);
 	if (uv_.has_value())
 	{
@@ -56,31 +63,27 @@ bool Triangle::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
 	return true;
 }
 
-float Triangle::pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const
+bool Triangle::occluded(const Ray &r, Interval ray_t) const
 {
-	HitRecord rec;
-	if (!hit(Ray(origin, direction), Interval{0.001f, std::numeric_limits<float>::max()}, rec))
-		return 0.0f;
-
-	auto distance_squared = rec.t * rec.t * glm::dot(direction, direction);
-	auto cosine           = std::fabs(glm::dot(direction, rec.normal) / glm::length(direction));
-
-	return distance_squared / (cosine * area_);
+	float t, u, v;
+	return intersect(r, ray_t, t, u, v);
 }
 
-glm::vec3 Triangle::random(const glm::vec3 &origin) const
+void Triangle::collect_emitters(std::vector<Emitter> &emitters)
 {
-	float r1 = random_float();
-	float r2 = random_float();
+	if (!material_ || !material_->is_light())
+		return;
+
+	light_id_ = static_cast<uint32_t>(emitters.size());
 
-	if (r1 + r2 >= 1.0f)
+	glm::vec3 centroid = (v0_ + v1_ + v2_) / 3.0f;
+	glm::vec2 uv{0.0f};
+	if (uv_.has_value())
 	{
-		r1 = 1.0f - r1;
-		r2 = 1.0f - r2;
+		auto &uv_values = uv_.value();
+		uv              = (uv_values[0] + uv_values[1] + uv_values[2]) / 3.0f;
 	}
-
-	auto random_point = v0_ + r1 * (v1_ - v0_) + r2 * (v2_ - v0_);
-	return random_point - origin;
+	emitters.push_back({v0_, v1_ - v0_, v2_ - v0_, material_->emitted(uv.x, uv.y, centroid)});
 }
 
 Aabb Triangle::bounding_box() const
@@ -18,14 +18,16 @@ class Triangle : public Hittable
 
 	bool hit(const Ray &r, Interval ray_t, HitRecord &rec) const override;
 
-	float pdf_value(const glm::vec3 &origin, const glm::vec3 &direction) const override;
+	bool occluded(const Ray &r, Interval ray_t) const override;
 
-
-	glm::vec3 random(const glm::vec3 &origin) const override;
+	void collect_emitters(std::vector<Emitter> &emitters) override;
 
 	Aabb bounding_box() const override;
 
   private:
+	// Moller-Trumbore, returns the distance and barycentrics without touching a HitRecord
+	bool intersect(const Ray &r, const Interval &ray_t, float &t, float &u, float &v) const;
+
 	void set_bounding_box();
 
 private:
@@ -34,7 +36,7 @@ private:
 	glm::vec3 v2_;
 	glm::vec3 normal_;
 	std::optional < std::array<glm::vec2, 3>> uv_;
-	float     area_;
+	uint32_t  light_id_{INVALID_LIGHT_ID};
 
 	Aabb                      b_box_;
 	std::shared_ptr<Material> material_;
@@ -0,0 +1,383 @@
+#include "ray_tracing/triangle_mesh.h"
+
+#include "core/timer.h"
+#include "ray_tracing/bvh_traversal.h"
+
+namespace mengze::rt
+{
+namespace
+{
+constexpr float EPSILON = 1e-8f;
+
+#if defined(__SSE2__) || defined(_M_X64)
+inline __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+// a.y * b.z - a.z * b.y
+inline __m128 cross_component(__m128 ay, __m128 az, __m128 by, __m128 bz)
+{
+	return _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+}
+#endif
+}        // namespace
+
+TriangleMesh::TriangleMesh(std::vector<glm::vec3> positions, std::vector<glm::vec2> uvs, const std::vector<uint32_t> &indices,
+                           const std::shared_ptr<Material> &material, const BvhBuildOptions &options) :
+    positions_(std::move(positions)), uvs_(std::move(uvs)), material_(material)
+{
+	auto triangle_count = static_cast<uint32_t>(indices.size() / 3);
+	if (triangle_count == 0)
+	{
+		return;
+	}
+
+	Timer timer;
+
+	std::vector<Aabb> bounds;
+	bounds.reserve(triangle_count);
+	for (uint32_t i = 0; i < triangle_count; ++i)
+	{
+		const auto &p0 = positions_[indices[3 * i]];
+		const auto &p1 = positions_[indices[3 * i + 1]];
+		const auto &p2 = positions_[indices[3 * i + 2]];
+		bounds.push_back(Aabb(glm::min(p0, glm::min(p1, p2)), glm::max(p0, glm::max(p1, p2))).pad());
+	}
+
+	BvhBuilder            builder(options);
+	std::vector<uint32_t> order;
+	builder.build(bounds, nodes_, order);
+
+	auto padded_count = triangle_count + SIMD_WIDTH - 1;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		v0_[axis].assign(padded_count, 0.0f);
+		edge1_[axis].assign(padded_count, 0.0f);
+		edge2_[axis].assign(padded_count, 0.0f);
+	}
+	indices_.resize(3 * triangle_count);
+
+	for (uint32_t i = 0; i < triangle_count; ++i)
+	{
+		auto source = order[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			indices_[3 * i + k] = indices[3 * source + k];
+		}
+
+		const auto &p0 = positions_[indices_[3 * i]];
+		const auto &p1 = positions_[indices_[3 * i + 1]];
+		const auto &p2 = positions_[indices_[3 * i + 2]];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			v0_[axis][i]    = p0[axis];
+			edge1_[axis][i] = p1[axis] - p0[axis];
+			edge2_[axis][i] = p2[axis] - p0[axis];
+		}
+	}
+
+	box_        = Aabb(nodes_[0].min, nodes_[0].max);
+	sah_cost_   = builder.sah_cost(nodes_);
+	build_time_ = timer.elapsed();
+}
+
+bool TriangleMesh::hit(const Ray &r, Interval ray_t, HitRecord &rec) const
+{
+	TriangleHit closest;
+	if (!closest_hit(r, ray_t, closest))
+	{
+		return false;
+	}
+
+	fill_record(r, closest, ray_t.max(), rec);
+	return true;
+}
+
+bool TriangleMesh::occluded(const Ray &r, Interval ray_t) const
+{
+	auto occluded_leaf = [&](uint32_t first, uint32_t count) {
+		alignas(16) float t[SIMD_WIDTH];
+		alignas(16) float u[SIMD_WIDTH];
+		alignas(16) float v[SIMD_WIDTH];
+		for (uint32_t i = first; i < first + count; i += SIMD_WIDTH)
+		{
+			if (intersect_group(r, i, first + count, ray_t, t, u, v))
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if (!wide_.empty())
+	{
+		return wide_.occluded(r, ray_t, occluded_leaf);
+	}
+	return bvh::occluded(nodes_, r, ray_t, occluded_leaf);
+}
+
+LaneMask TriangleMesh::hit_packet(RayPacket &packet, LaneMask active, HitRecord *records) const
+{
+	return bvh::intersect_packet(nodes_, packet, active, [&](uint32_t first, uint32_t count, LaneMask lanes) {
+		LaneMask hits = 0;
+		for (; lanes; lanes &= lanes - 1)
+		{
+			int         lane = lowest_lane(lanes);
+			Interval    ray_t(packet.t_min, packet.t_max[lane]);
+			TriangleHit closest;
+			if (intersect_triangles(packet.rays[lane], first, count, ray_t, closest))
+			{
+				packet.t_max[lane] = ray_t.max();
+				fill_record(packet.rays[lane], closest, ray_t.max(), records[lane]);
+				hits |= LaneMask{1} << lane;
+			}
+		}
+		return hits;
+	});
+}
+
+bool TriangleMesh::closest_hit(const Ray &r, Interval &ray_t, TriangleHit &closest) const
+{
+	auto intersect_leaf = [&](uint32_t first, uint32_t count, Interval &leaf_t) {
+		return intersect_triangles(r, first, count, leaf_t, closest);
+	};
+
+	if (!wide_.empty())
+	{
+		return wide_.intersect(r, ray_t, intersect_leaf);
+	}
+	return bvh::intersect(nodes_, r, ray_t, intersect_leaf);
+}
+
+bool TriangleMesh::intersect_triangles(const Ray &r, uint32_t first, uint32_t count, Interval &ray_t, TriangleHit &closest) const
+{
+	alignas(16) float t[SIMD_WIDTH];
+	alignas(16) float u[SIMD_WIDTH];
+	alignas(16) float v[SIMD_WIDTH];
+
+	bool hit_anything = false;
+	for (uint32_t i = first; i < first + count; i += SIMD_WIDTH)
+	{
+		uint32_t mask = intersect_group(r, i, first + count, ray_t, t, u, v);
+		for (uint32_t lane = 0; mask; ++lane, mask >>= 1)
+		{
+			if ((mask & 1) && t[lane] <= ray_t.max())
+			{
+				ray_t.max()      = t[lane];
+				closest.triangle = i + lane;
+				closest.u        = u[lane];
+				closest.v        = v[lane];
+				hit_anything     = true;
+			}
+		}
+	}
+	return hit_anything;
+}
+
+uint32_t TriangleMesh::intersect_group(const Ray &r, uint32_t first, uint32_t end, const Interval &ray_t, float *t_out, float *u_out, float *v_out) const
+{
+	// Lanes past the end of the leaf belong to other leaves
+	uint32_t lanes     = std::min(end - first, SIMD_WIDTH);
+	uint32_t lane_mask = (1u << lanes) - 1;
+
+#if defined(__SSE2__) || defined(_M_X64)
+	const __m128 dx = _mm_set1_ps(r.direction().x);
+	const __m128 dy = _mm_set1_ps(r.direction().y);
+	const __m128 dz = _mm_set1_ps(r.direction().z);
+
+	const __m128 zero      = _mm_setzero_ps();
+	const __m128 one       = _mm_set1_ps(1.0f);
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+	__m128 e1x = _mm_loadu_ps(&edge1_[0][first]);
+	__m128 e1y = _mm_loadu_ps(&edge1_[1][first]);
+	__m128 e1z = _mm_loadu_ps(&edge1_[2][first]);
+	__m128 e2x = _mm_loadu_ps(&edge2_[0][first]);
+	__m128 e2y = _mm_loadu_ps(&edge2_[1][first]);
+	__m128 e2z = _mm_loadu_ps(&edge2_[2][first]);
+
+	// Moller-Trumbore with the edges read from the precomputed arrays
+	__m128 hx = cross_component(dy, dz, e2y, e2z);
+	__m128 hy = cross_component(dz, dx, e2z, e2x);
+	__m128 hz = cross_component(dx, dy, e2x, e2y);
+	__m128 a  = dot(e1x, e1y, e1z, hx, hy, hz);
+	__m128 f  = _mm_div_ps(one, a);
+
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(r.origin().x), _mm_loadu_ps(&v0_[0][first]));
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(r.origin().y), _mm_loadu_ps(&v0_[1][first]));
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(r.origin().z), _mm_loadu_ps(&v0_[2][first]));
+	__m128 u  = _mm_mul_ps(f, dot(sx, sy, sz, hx, hy, hz));
+
+	__m128 qx = cross_component(sy, sz, e1y, e1z);
+	__m128 qy = cross_component(sz, sx, e1z, e1x);
+	__m128 qz = cross_component(sx, sy, e1x, e1y);
+	__m128 v  = _mm_mul_ps(f, dot(dx, dy, dz, qx, qy, qz));
+	__m128 t  = _mm_mul_ps(f, dot(e2x, e2y, e2z, qx, qy, qz));
+
+	__m128 valid = _mm_cmpgt_ps(_mm_andnot_ps(sign_mask, a), _mm_set1_ps(EPSILON));
+	valid        = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+	valid        = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+	valid        = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+	valid        = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_set1_ps(ray_t.min())));
+	valid        = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(ray_t.max())));
+
+	uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(valid)) & lane_mask;
+	if (mask)
+	{
+		_mm_store_ps(t_out, t);
+		_mm_store_ps(u_out, u);
+		_mm_store_ps(v_out, v);
+	}
+	return mask;
+#else
+	uint32_t mask = 0;
+	for (uint32_t lane = 0; lane < lanes; ++lane)
+	{
+		uint32_t  i  = first + lane;
+		glm::vec3 e1 = edge1(i);
+		glm::vec3 e2 = edge2(i);
+		glm::vec3 h  = glm::cross(r.direction(), e2);
+		float     a  = glm::dot(e1, h);
+
+		if (a > -EPSILON && a < EPSILON)
+			continue;
+
+		float     f = 1.0f / a;
+		glm::vec3 s = r.origin() - v0(i);
+		float     u = f * glm::dot(s, h);
+
+		if (u < 0.0f || u > 1.0f)
+			continue;
+
+		glm::vec3 q = glm::cross(s, e1);
+		float     v = f * glm::dot(r.direction(), q);
+
+		if (v < 0.0f || u + v > 1.0f)
+			continue;
+
+		float t = f * glm::dot(e2, q);
+
+		if (t < ray_t.min() || t > ray_t.max())
+			continue;
+
+		t_out[lane] = t;
+		u_out[lane] = u;
+		v_out[lane] = v;
+		mask |= 1u << lane;
+	}
+	return mask;
+#endif
+}
+
+void TriangleMesh::fill_record(const Ray &r, const TriangleHit &hit, float t, HitRecord &rec) const
+{
+	auto triangle = hit.triangle;
+	auto u        = hit.u;
+	auto v        = hit.v;
+
+	rec.t            = t;
+	rec.position     = r.at(t);
+	rec.material     = material_;
+	rec.primitive_id = triangle;
+	rec.light_id     = first_light_id_ == INVALID_LIGHT_ID ? INVALID_LIGHT_ID : first_light_id_ + triangle;
+	rec.set_face_normal(r, normal(triangle));
+
+	if (!uvs_.empty())
+	{
+		const auto &uv0 = uvs_[indices_[3 * triangle]];
+		const auto &uv1 = uvs_[indices_[3 * triangle + 1]];
+		const auto &uv2 = uvs_[indices_[3 * triangle + 2]];
+		float       w   = 1.0f - u - v;
+		rec.u           = w * uv0.x + u * uv1.x + v * uv2.x;
+		rec.v           = w * uv0.y + u * uv1.y + v * uv2.y;
+	}
+}
+
+Aabb TriangleMesh::bounding_box() const
+{
+	return box_;
+}
+
+void TriangleMesh::collect_emitters(std::vector<Emitter> &emitters)
+{
+	if (!material_ || !material_->is_light())
+		return;
+
+	first_light_id_ = static_cast<uint32_t>(emitters.size());
+	for (uint32_t triangle = 0; triangle < triangle_count(); ++triangle)
+	{
+		Emitter emitter{v0(triangle), edge1(triangle), edge2(triangle), glm::vec3{0.0f}};
+
+		glm::vec3 centroid = emitter.v0 + (emitter.edge1 + emitter.edge2) / 3.0f;
+		glm::vec2 uv{0.0f};
+		if (!uvs_.empty())
+		{
+			uv = (uvs_[indices_[3 * triangle]] + uvs_[indices_[3 * triangle + 1]] + uvs_[indices_[3 * triangle + 2]]) / 3.0f;
+		}
+		emitter.radiance = material_->emitted(uv.x, uv.y, centroid);
+		emitters.push_back(emitter);
+	}
+}
+
+void TriangleMesh::collapse()
+{
+	wide_ = WideBvh(nodes_);
+}
+
+bool TriangleMesh::is_collapsed() const
+{
+	return !wide_.empty();
+}
+
+size_t TriangleMesh::triangle_count() const
+{
+	return indices_.size() / 3;
+}
+
+size_t TriangleMesh::node_count() const
+{
+	return nodes_.size();
+}
+
+float TriangleMesh::sah_cost() const
+{
+	return sah_cost_;
+}
+
+float TriangleMesh::build_time() const
+{
+	return build_time_;
+}
+
+size_t TriangleMesh::memory_usage() const
+{
+	size_t bytes = positions_.size() * sizeof(glm::vec3) + uvs_.size() * sizeof(glm::vec2) + indices_.size() * sizeof(uint32_t);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		bytes += (v0_[axis].size() + edge1_[axis].size() + edge2_[axis].size()) * sizeof(float);
+	}
+	bytes += nodes_.size() * sizeof(BvhNode) + wide_.node_count() * sizeof(WideBvhNode);
+	return bytes;
+}
+
+glm::vec3 TriangleMesh::v0(uint32_t triangle) const
+{
+	return {v0_[0][triangle], v0_[1][triangle], v0_[2][triangle]};
+}
+
+glm::vec3 TriangleMesh::edge1(uint32_t triangle) const
+{
+	return {edge1_[0][triangle], edge1_[1][triangle], edge1_[2][triangle]};
+}
+
+glm::vec3 TriangleMesh::edge2(uint32_t triangle) const
+{
+	return {edge2_[0][triangle], edge2_[1][triangle], edge2_[2][triangle]};
+}
+
+glm::vec3 TriangleMesh::normal(uint32_t triangle) const
+{
+	return glm::normalize(glm::cross(edge1(triangle), edge2(triangle)));
+}
+}        // namespace mengze::rt
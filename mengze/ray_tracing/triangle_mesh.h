@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/aabb.h"
+#include "ray_tracing/bvh_builder.h"
+#include "ray_tracing/hittable.h"
+#include "ray_tracing/wide_bvh.h"
+
+namespace mengze::rt
+{
+/**
+ * @brief Indexed triangle mesh with a single material and its own BVH.
+ *
+ * Positions and UVs are shared between triangles through the index buffer. For intersection every
+ * triangle keeps v0 and its two edges in SoA arrays stored in the primitive order of the BVH, so a
+ * leaf is a contiguous range that is tested four triangles at a time.
+ */
+class TriangleMesh final : public Hittable
+{
+  public:
+	// uvs is either empty or has one entry per position, indices holds three entries per triangle
+	TriangleMesh(std::vector<glm::vec3> positions, std::vector<glm::vec2> uvs, const std::vector<uint32_t> &indices,
+	             const std::shared_ptr<Material> &material, const BvhBuildOptions &options = {});
+
+	bool hit(const Ray &r, Interval ray_t, HitRecord &rec) const override;
+
+	bool occluded(const Ray &r, Interval ray_t) const override;
+
+	LaneMask hit_packet(RayPacket &packet, LaneMask active, HitRecord *records) const override;
+
+	Aabb bounding_box() const override;
+
+	void collect_emitters(std::vector<Emitter> &emitters) override;
+
+	// Collapses the binary tree into a BVH4/BVH8 that is used for single rays from then on
+	void collapse();
+
+	bool is_collapsed() const;
+
+	size_t triangle_count() const;
+
+	size_t node_count() const;
+
+	float sah_cost() const;
+
+	// Build time in milliseconds
+	float build_time() const;
+
+	// Bytes held by the vertex, index, intersection and BVH buffers
+	size_t memory_usage() const;
+
+  private:
+	struct TriangleHit
+	{
+		uint32_t triangle;
+		float    u;
+		float    v;
+	};
+
+	// Shrinks ray_t.max() to the closest hit, the HitRecord is left to the caller
+	bool closest_hit(const Ray &r, Interval &ray_t, TriangleHit &closest) const;
+
+	bool intersect_triangles(const Ray &r, uint32_t first, uint32_t count, Interval &ray_t, TriangleHit &closest) const;
+
+	// Tests the triangles [first, min(first + SIMD_WIDTH, end)) and returns the mask of those hit within
+	// ray_t, their t, u and v are written only when the mask is not empty
+	uint32_t intersect_group(const Ray &r, uint32_t first, uint32_t end, const Interval &ray_t, float *t, float *u, float *v) const;
+
+	void fill_record(const Ray &r, const TriangleHit &hit, float t, HitRecord &rec) const;
+
+	glm::vec3 v0(uint32_t triangle) const;
+
+	glm::vec3 edge1(uint32_t triangle) const;
+
+	glm::vec3 edge2(uint32_t triangle) const;
+
+	glm::vec3 normal(uint32_t triangle) const;
+
+  private:
+	// Triangles are tested in groups of four, the SoA arrays are padded so the last group can be loaded
+	static constexpr uint32_t SIMD_WIDTH = 4;
+
+	std::vector<glm::vec3> positions_;
+	std::vector<glm::vec2> uvs_;
+	std::vector<uint32_t>  indices_;        // three per triangle, in BVH order
+
+	// Per-axis SoA of v0, v1 - v0 and v2 - v0, in BVH order
+	std::vector<float> v0_[3];
+	std::vector<float> edge1_[3];
+	std::vector<float> edge2_[3];
+
+	std::vector<BvhNode> nodes_;
+	WideBvh              wide_;
+
+	Aabb                      box_;
+	std::shared_ptr<Material> material_;
+	uint32_t                  first_light_id_{INVALID_LIGHT_ID};
+
+	float sah_cost_{0.0f};
+	float build_time_{0.0f};
+};
+}        // namespace mengze::rt
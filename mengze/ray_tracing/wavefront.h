@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_tracing/hittable.h"
+#include "ray_tracing/ray.h"
+#include "ray_tracing/sampler.h"
+
+namespace mengze::rt
+{
+/**
+ * @brief Path state of a wavefront frame, one path per pixel stored as structure of arrays.
+ *
+ * The path of pixel i lives at index i of every array. Stages never move path state around, they walk
+ * queues of path indices instead, so compaction and sorting by material only shuffle 32-bit indices.
+ */
+struct WavefrontPaths
+{
+	std::vector<Ray>       rays;
+	std::vector<HitRecord> records;
+	std::vector<Sampler>   samplers;
+	std::vector<glm::vec3> throughputs;
+	std::vector<glm::vec3> radiances;
+
+	// State of the previous vertex, needed to weight emission found by its BSDF sample
+	std::vector<glm::vec3> previous_positions;
+	std::vector<float>     bsdf_pdfs;
+	std::vector<uint8_t>   specular_bounces;
+
+	// Set by the intersection stage for hits and by shading for paths that continue
+	std::vector<uint8_t> alive;
+
+	// Light sample of the current vertex, its contribution is added when the shadow ray is unoccluded
+	std::vector<Ray>       shadow_rays;
+	std::vector<glm::vec3> shadow_contributions;
+	std::vector<uint8_t>   has_shadow_ray;
+
+	std::vector<uint32_t> path_queue;          // paths with a ray to trace
+	std::vector<uint32_t> shadow_queue;        // paths with a shadow ray to trace
+
+	void resize(size_t count)
+	{
+		rays.resize(count);
+		records.resize(count);
+		samplers.resize(count);
+		throughputs.resize(count);
+		radiances.resize(count);
+		previous_positions.resize(count);
+		bsdf_pdfs.resize(count);
+		specular_bounces.resize(count);
+		alive.resize(count);
+		shadow_rays.resize(count);
+		shadow_contributions.resize(count);
+		has_shadow_ray.resize(count);
+		path_queue.reserve(count);
+		shadow_queue.reserve(count);
+	}
+};
+}        // namespace mengze::rt
@@ -0,0 +1,111 @@
+#include "ray_tracing/wide_bvh.h"
+
+namespace mengze::rt
+{
+namespace
+{
+float half_area(const BvhNode &node)
+{
+	glm::vec3 d = node.max - node.min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+}        // namespace
+
+WideBvh::WideBvh(const std::vector<BvhNode> &binary_nodes)
+{
+	if (binary_nodes.empty())
+	{
+		return;
+	}
+
+	nodes_.reserve(binary_nodes.size() / (WIDE_BVH_WIDTH - 1) + 1);
+	collapse(binary_nodes, 0);
+	nodes_.shrink_to_fit();
+}
+
+uint32_t WideBvh::collapse(const std::vector<BvhNode> &binary_nodes, uint32_t binary_index)
+{
+	auto wide_index = static_cast<uint32_t>(nodes_.size());
+	nodes_.emplace_back();
+
+	// Open up the largest interior child until every slot is used, this keeps the children of a wide
+	// node as tight as the binary tree allows
+	uint32_t children[WIDE_BVH_WIDTH];
+	int      child_count = 0;
+
+	const auto &root = binary_nodes[binary_index];
+	if (root.is_leaf())
+	{
+		children[child_count++] = binary_index;
+	}
+	else
+	{
+		children[child_count++] = binary_index + 1;
+		children[child_count++] = root.offset;
+	}
+
+	while (child_count < WIDE_BVH_WIDTH)
+	{
+		int   largest      = -1;
+		float largest_area = -1.0f;
+		for (int i = 0; i < child_count; ++i)
+		{
+			const auto &child = binary_nodes[children[i]];
+			if (!child.is_leaf() && half_area(child) > largest_area)
+			{
+				largest      = i;
+				largest_area = half_area(child);
+			}
+		}
+
+		if (largest < 0)
+		{
+			break;
+		}
+
+		auto opened             = children[largest];
+		children[largest]       = opened + 1;
+		children[child_count++] = binary_nodes[opened].offset;
+	}
+
+	WideBvhNode node;
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i)
+	{
+		node.min_x[i] = node.min_y[i] = node.min_z[i] = std::numeric_limits<float>::infinity();
+		node.max_x[i] = node.max_y[i] = node.max_z[i] = -std::numeric_limits<float>::infinity();
+		node.child[i]                                 = 0;
+		node.count[i]                                 = 0;
+	}
+
+	for (int i = 0; i < child_count; ++i)
+	{
+		const auto &child = binary_nodes[children[i]];
+
+		node.min_x[i] = child.min.x;
+		node.min_y[i] = child.min.y;
+		node.min_z[i] = child.min.z;
+		node.max_x[i] = child.max.x;
+		node.max_y[i] = child.max.y;
+		node.max_z[i] = child.max.z;
+
+		if (child.is_leaf())
+		{
+			node.child[i] = child.offset;
+			node.count[i] = child.count;
+		}
+	}
+	nodes_[wide_index] = node;
+
+	// Recursing may reallocate nodes_, so the interior indices are written back one at a time
+	for (int i = 0; i < child_count; ++i)
+	{
+		if (!binary_nodes[children[i]].is_leaf())
+		{
+			auto child_index            = collapse(binary_nodes, children[i]);
+			nodes_[wide_index].child[i] = child_index;
+		}
+	}
+
+	return wide_index;
+}
+}        // namespace mengze::rt
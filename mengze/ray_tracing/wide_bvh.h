@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#	include <emmintrin.h>
+#endif
+
+#include "ray_tracing/bvh_builder.h"
+#include "ray_tracing/math.h"
+#include "ray_tracing/ray.h"
+
+namespace mengze::rt
+{
+#if defined(__AVX2__)
+constexpr int WIDE_BVH_WIDTH = 8;
+#else
+constexpr int WIDE_BVH_WIDTH = 4;
+#endif
+
+// Child bounds are stored per axis (SoA) so one ray is tested against all children at once. Unused
+// slots have inverted bounds and never report a hit.
+struct alignas(32) WideBvhNode
+{
+	float min_x[WIDE_BVH_WIDTH];
+	float max_x[WIDE_BVH_WIDTH];
+	float min_y[WIDE_BVH_WIDTH];
+	float max_y[WIDE_BVH_WIDTH];
+	float min_z[WIDE_BVH_WIDTH];
+	float max_z[WIDE_BVH_WIDTH];
+
+	uint32_t child[WIDE_BVH_WIDTH];        // leaf child: first primitive, interior child: node index
+	uint16_t count[WIDE_BVH_WIDTH];        // primitives in a leaf child, 0 for interior children
+};
+
+/**
+ * @brief BVH4/BVH8 collapsed from a binary BVH, using the primitive order of the binary tree.
+ *
+ * The width follows the instruction set the renderer is compiled for: 8 with AVX2, 4 otherwise.
+ */
+class WideBvh
+{
+  public:
+	WideBvh() = default;
+
+	explicit WideBvh(const std::vector<BvhNode> &binary_nodes);
+
+	bool empty() const
+	{
+		return nodes_.empty();
+	}
+
+	size_t node_count() const
+	{
+		return nodes_.size();
+	}
+
+	/**
+	 * @brief Visits hit children front to back and skips those entered beyond the closest hit so far.
+	 * @param intersect_leaf bool(uint32_t first, uint32_t count, Interval &ray_t), shrinks ray_t.max()
+	 *        and returns true when a primitive of the leaf was hit
+	 */
+	template <typename LeafIntersector>
+	bool intersect(const Ray &r, Interval &ray_t, LeafIntersector &&intersect_leaf) const;
+
+	/**
+	 * @brief Any-hit traversal, children are visited in slot order and the first hit ends the walk.
+	 * @param occluded_leaf bool(uint32_t first, uint32_t count), true when any primitive of the leaf is hit
+	 */
+	template <typename LeafOccluder>
+	bool occluded(const Ray &r, const Interval &ray_t, LeafOccluder &&occluded_leaf) const;
+
+  private:
+	struct StackEntry
+	{
+		uint32_t index;
+		uint32_t count;
+		float    t;
+	};
+
+	uint32_t collapse(const std::vector<BvhNode> &binary_nodes, uint32_t binary_index);
+
+	static uint32_t intersect_children(const WideBvhNode &node, const Ray &r, const Interval &ray_t, float *t_near);
+
+  private:
+	// Every level below the root descends at least one binary level and leaves at most width - 1 siblings behind
+	static constexpr int MAX_STACK_SIZE = MAX_BVH_DEPTH * (WIDE_BVH_WIDTH - 1) + 1;
+
+	std::vector<WideBvhNode> nodes_;
+};
+
+inline uint32_t WideBvh::intersect_children(const WideBvhNode &node, const Ray &r, const Interval &ray_t, float *t_near)
+{
+	const auto &origin        = r.origin();
+	const auto &inv_direction = r.inv_direction();
+
+	// Picking the near and far plane by direction sign keeps empty slots (min > max) from ever hitting
+	const float *near_x = r.sign(0) ? node.max_x : node.min_x;
+	const float *far_x  = r.sign(0) ? node.min_x : node.max_x;
+	const float *near_y = r.sign(1) ? node.max_y : node.min_y;
+	const float *far_y  = r.sign(1) ? node.min_y : node.max_y;
+	const float *near_z = r.sign(2) ? node.max_z : node.min_z;
+	const float *far_z  = r.sign(2) ? node.min_z : node.max_z;
+
+#if defined(__AVX2__)
+	const __m256 ox = _mm256_set1_ps(origin.x);
+	const __m256 oy = _mm256_set1_ps(origin.y);
+	const __m256 oz = _mm256_set1_ps(origin.z);
+	const __m256 ix = _mm256_set1_ps(inv_direction.x);
+	const __m256 iy = _mm256_set1_ps(inv_direction.y);
+	const __m256 iz = _mm256_set1_ps(inv_direction.z);
+
+	__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_x), ox), ix);
+	__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_y), oy), iy);
+	__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_z), oz), iz);
+	__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_x), ox), ix);
+	__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_y), oy), iy);
+	__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_z), oz), iz);
+
+	__m256 t_enter = _mm256_max_ps(_mm256_max_ps(t0x, t0y), _mm256_max_ps(t0z, _mm256_set1_ps(ray_t.min())));
+	__m256 t_exit  = _mm256_min_ps(_mm256_min_ps(t1x, t1y), _mm256_min_ps(t1z, _mm256_set1_ps(ray_t.max())));
+
+	_mm256_store_ps(t_near, t_enter);
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+#elif defined(__SSE2__) || defined(_M_X64)
+	const __m128 ox = _mm_set1_ps(origin.x);
+	const __m128 oy = _mm_set1_ps(origin.y);
+	const __m128 oz = _mm_set1_ps(origin.z);
+	const __m128 ix = _mm_set1_ps(inv_direction.x);
+	const __m128 iy = _mm_set1_ps(inv_direction.y);
+	const __m128 iz = _mm_set1_ps(inv_direction.z);
+
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_x), ox), ix);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y), oy), iy);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_z), oz), iz);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_x), ox), ix);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y), oy), iy);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_z), oz), iz);
+
+	__m128 t_enter = _mm_max_ps(_mm_max_ps(t0x, t0y), _mm_max_ps(t0z, _mm_set1_ps(ray_t.min())));
+	__m128 t_exit  = _mm_min_ps(_mm_min_ps(t1x, t1y), _mm_min_ps(t1z, _mm_set1_ps(ray_t.max())));
+
+	_mm_store_ps(t_near, t_enter);
+	return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i)
+	{
+		float t_enter = std::max(std::max((near_x[i] - origin.x) * inv_direction.x, (near_y[i] - origin.y) * inv_direction.y),
+		                         std::max((near_z[i] - origin.z) * inv_direction.z, ray_t.min()));
+		float t_exit  = std::min(std::min((far_x[i] - origin.x) * inv_direction.x, (far_y[i] - origin.y) * inv_direction.y),
+		                         std::min((far_z[i] - origin.z) * inv_direction.z, ray_t.max()));
+		t_near[i]     = t_enter;
+		if (t_enter <= t_exit)
+		{
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+template <typename LeafIntersector>
+bool WideBvh::intersect(const Ray &r, Interval &ray_t, LeafIntersector &&intersect_leaf) const
+{
+	if (nodes_.empty())
+	{
+		return false;
+	}
+
+	StackEntry stack[MAX_STACK_SIZE];
+	int        stack_size   = 0;
+	bool       hit_anything = false;
+
+	stack[stack_size++] = {0, 0, ray_t.min()};
+
+	while (stack_size > 0)
+	{
+		auto entry = stack[--stack_size];
+		if (entry.t > ray_t.max())
+		{
+			continue;
+		}
+
+		if (entry.count > 0)
+		{
+			hit_anything |= intersect_leaf(entry.index, entry.count, ray_t);
+			continue;
+		}
+
+		const auto &node = nodes_[entry.index];
+
+		alignas(32) float t_near[WIDE_BVH_WIDTH];
+		uint32_t          mask = intersect_children(node, r, ray_t, t_near);
+
+		// Insert hit children sorted by entry distance, farthest first so the nearest ends up on top
+		assert(stack_size + WIDE_BVH_WIDTH <= MAX_STACK_SIZE);
+		int first = stack_size;
+		for (int i = 0; i < WIDE_BVH_WIDTH; ++i)
+		{
+			if (!(mask & (1u << i)))
+			{
+				continue;
+			}
+
+			StackEntry child{node.child[i], node.count[i], t_near[i]};
+			int        j = stack_size++;
+			while (j > first && stack[j - 1].t < child.t)
+			{
+				stack[j] = stack[j - 1];
+				--j;
+			}
+			stack[j] = child;
+		}
+	}
+
+	return hit_anything;
+}
+
+template <typename LeafOccluder>
+bool WideBvh::occluded(const Ray &r, const Interval &ray_t, LeafOccluder &&occluded_leaf) const
+{
+	if (nodes_.empty())
+	{
+		return false;
+	}
+
+	uint32_t stack[MAX_STACK_SIZE];
+	int      stack_size = 0;
+
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0)
+	{
+		const auto &node = nodes_[stack[--stack_size]];
+
+		alignas(32) float t_near[WIDE_BVH_WIDTH];
+		uint32_t          mask = intersect_children(node, r, ray_t, t_near);
+
+		// Leaf children are tested right away, only interior children go on the stack
+		assert(stack_size + WIDE_BVH_WIDTH <= MAX_STACK_SIZE);
+		for (int i = 0; i < WIDE_BVH_WIDTH; ++i)
+		{
+			if (!(mask & (1u << i)))
+			{
+				continue;
+			}
+
+			if (node.count[i] > 0)
+			{
+				if (occluded_leaf(node.child[i], node.count[i]))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				stack[stack_size++] = node.child[i];
+			}
+		}
+	}
+
+	return false;
+}
+}        // namespace mengze::rt